@@ -0,0 +1,229 @@
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+#include "ArenaBlockStore.hpp"
+
+using namespace std;
+
+/**
+ * Record layout in a slab, 8-byte aligned:
+ *
+ *   | hash:32 bytes | length:u32 | codec:u8 | padding:3 | payload |
+ */
+static const size_t RECORD_HEADER_SIZE = BlockHash::SIZE + 8;
+static const size_t RECORD_ALIGN = 8;
+static const size_t INITIAL_SLOTS = 64;
+
+static uint64_t tag_of(const BlockHash &hash)
+{
+    uint64_t tag;
+    memcpy(&tag, hash.bytes, sizeof(tag));
+    return tag;
+}
+
+static uint32_t record_length(const char *record)
+{
+    uint32_t length;
+    memcpy(&length, record + BlockHash::SIZE, sizeof(length));
+    return length;
+}
+
+static BlockView record_view(const char *record)
+{
+    return BlockView{record + RECORD_HEADER_SIZE, record_length(record),
+                     (BlockCodec::Codec)(uint8_t)record[BlockHash::SIZE + sizeof(uint32_t)], nullptr};
+}
+
+ArenaBlockStore::ArenaBlockStore(size_t t_slab_size, size_t t_num_shards)
+    : slab_size(t_slab_size), slab_used(0), slab_capacity(0), slab_bytes(0)
+{
+    for (size_t i = 0; i < t_num_shards; ++i)
+    {
+        shards.push_back(unique_ptr<Shard>(new Shard()));
+        shards.back()->slots.assign(INITIAL_SLOTS, Slot{0, nullptr});
+        shards.back()->used = 0;
+    }
+}
+
+bool ArenaBlockStore::store(const BlockHash &hash, const string &data, BlockCodec::Codec codec)
+{
+    Shard &shard = shard_for(hash);
+    lock_guard<mutex> guard(shard.lock);
+
+    if (find(shard, hash) != nullptr)
+    {
+        return false;
+    }
+
+    char *record = allocate(RECORD_HEADER_SIZE + data.size());
+    uint32_t length = (uint32_t)data.size();
+    memcpy(record, hash.bytes, BlockHash::SIZE);
+    memcpy(record + BlockHash::SIZE, &length, sizeof(length));
+    record[BlockHash::SIZE + sizeof(length)] = (char)codec;
+    memcpy(record + RECORD_HEADER_SIZE, data.data(), data.size());
+
+    // keep the table at most half full, so probe runs stay short
+    if (2 * (shard.used + 1) > shard.slots.size())
+    {
+        vector<Slot> bigger(2 * shard.slots.size(), Slot{0, nullptr});
+        for (const Slot &slot : shard.slots)
+        {
+            if (slot.record != nullptr)
+            {
+                place(bigger, slot);
+            }
+        }
+        shard.slots.swap(bigger);
+    }
+    place(shard.slots, Slot{tag_of(hash), record});
+    ++shard.used;
+    return true;
+}
+
+bool ArenaBlockStore::get(const BlockHash &hash, string &data, BlockCodec::Codec &codec)
+{
+    BlockView view;
+    if (!get_view(hash, view))
+    {
+        return false;
+    }
+    data.assign(view.data, view.length);
+    codec = view.codec;
+    return true;
+}
+
+bool ArenaBlockStore::get_view(const BlockHash &hash, BlockView &view)
+{
+    Shard &shard = shard_for(hash);
+    lock_guard<mutex> guard(shard.lock);
+    const char *record = find(shard, hash);
+    if (record == nullptr)
+    {
+        return false;
+    }
+    view = record_view(record);
+    return true;
+}
+
+bool ArenaBlockStore::contains(const BlockHash &hash)
+{
+    Shard &shard = shard_for(hash);
+    lock_guard<mutex> guard(shard.lock);
+    return find(shard, hash) != nullptr;
+}
+
+list<BlockHash> ArenaBlockStore::hashes()
+{
+    list<BlockHash> all;
+    for (auto const &shard : shards)
+    {
+        lock_guard<mutex> guard(shard->lock);
+        for (const Slot &slot : shard->slots)
+        {
+            if (slot.record != nullptr)
+            {
+                BlockHash hash;
+                memcpy(hash.bytes, slot.record, BlockHash::SIZE);
+                all.push_back(hash);
+            }
+        }
+    }
+    return all;
+}
+
+size_t ArenaBlockStore::size()
+{
+    size_t total = 0;
+    for (auto const &shard : shards)
+    {
+        lock_guard<mutex> guard(shard->lock);
+        total += shard->used;
+    }
+    return total;
+}
+
+map<string, uint64_t> ArenaBlockStore::stats()
+{
+    uint64_t blocks = 0, index_bytes = 0;
+    for (auto const &shard : shards)
+    {
+        lock_guard<mutex> guard(shard->lock);
+        blocks += shard->used;
+        index_bytes += shard->slots.size() * sizeof(Slot);
+    }
+
+    lock_guard<mutex> guard(slab_lock);
+    map<string, uint64_t> out;
+    out["blocks"] = blocks;
+    out["index_bytes"] = index_bytes;
+    out["slabs"] = slabs.size();
+    out["slab_bytes"] = slab_bytes;
+    return out;
+}
+
+// the second 8 bytes of the hash pick the shard, so that shards and slots,
+// placed by the first 8, are independent
+ArenaBlockStore::Shard &ArenaBlockStore::shard_for(const BlockHash &hash)
+{
+    uint64_t key;
+    memcpy(&key, hash.bytes + sizeof(key), sizeof(key));
+    return *shards[key % shards.size()];
+}
+
+// the record for hash, or nullptr; shard's lock must be held
+const char *ArenaBlockStore::find(Shard &shard, const BlockHash &hash)
+{
+    uint64_t tag = tag_of(hash);
+    size_t mask = shard.slots.size() - 1;
+    for (size_t i = tag & mask;; i = (i + 1) & mask)
+    {
+        const Slot &slot = shard.slots[i];
+        if (slot.record == nullptr)
+        {
+            return nullptr;
+        }
+        if (slot.tag == tag && memcmp(slot.record, hash.bytes, BlockHash::SIZE) == 0)
+        {
+            return slot.record;
+        }
+    }
+}
+
+// carve size bytes out of the newest slab, starting a new one if it is full
+char *ArenaBlockStore::allocate(size_t size)
+{
+    size = (size + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+
+    lock_guard<mutex> guard(slab_lock);
+    if (size > slab_size)
+    {
+        // a slab of its own, leaving the newest slab in use
+        slabs.insert(slabs.empty() ? slabs.end() : slabs.end() - 1, unique_ptr<char[]>(new char[size]));
+        slab_bytes += size;
+        return slabs[slabs.size() == 1 ? 0 : slabs.size() - 2].get();
+    }
+    if (slabs.empty() || slab_used + size > slab_capacity)
+    {
+        // the rest of the old slab is wasted, less than one block's worth
+        slab_capacity = slab_size;
+        slabs.push_back(unique_ptr<char[]>(new char[slab_capacity]));
+        slab_used = 0;
+        slab_bytes += slab_capacity;
+    }
+    char *at = slabs.back().get() + slab_used;
+    slab_used += size;
+    return at;
+}
+
+// put slot into the first free slot of its probe run
+void ArenaBlockStore::place(vector<Slot> &slots, const Slot &slot)
+{
+    size_t mask = slots.size() - 1;
+    size_t i = slot.tag & mask;
+    while (slots[i].record != nullptr)
+    {
+        i = (i + 1) & mask;
+    }
+    slots[i] = slot;
+}
@@ -0,0 +1,79 @@
+#ifndef ARENABLOCKSTORE_HPP
+#define ARENABLOCKSTORE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BlockStore.hpp"
+
+using namespace std;
+
+/**
+ * An in-memory block store without a heap allocation per block.
+ *
+ * Blocks are appended to large slabs of slab_size bytes, each record being
+ * the block's 32-byte hash, its length and codec, and the payload. Blocks
+ * are never deleted, so slabs only ever fill up, and a record never moves:
+ * views stay valid for the lifetime of the store, as with MemoryBlockStore.
+ * A block larger than slab_size gets a slab of its own.
+ *
+ * The index is an open-addressing hash table with linear probing. A slot
+ * is 16 bytes: the first 8 bytes of the hash, which SHA-256 makes uniform
+ * enough to place and compare by, and a pointer to the record, which holds
+ * the rest of the hash. A lookup usually touches one cache line of the
+ * table and then the record itself, instead of chasing std::map nodes. The
+ * table doubles once it is half full; records stay where they are.
+ *
+ * Like ShardedMap, the index is split into shards by hash, each with its
+ * own lock, so concurrent RPC handlers rarely contend. Slabs are shared;
+ * carving a record out of one takes a short lock of its own.
+ */
+class ArenaBlockStore : public BlockStore
+{
+  public:
+    explicit ArenaBlockStore(size_t t_slab_size, size_t t_num_shards = 64);
+
+    bool store(const BlockHash &hash, const string &data, BlockCodec::Codec codec);
+    bool get(const BlockHash &hash, string &data, BlockCodec::Codec &codec);
+    bool get_view(const BlockHash &hash, BlockView &view);
+    bool contains(const BlockHash &hash);
+    list<BlockHash> hashes();
+    size_t size();
+    map<string, uint64_t> stats();
+
+  protected:
+    struct Slot
+    {
+        uint64_t tag;       // the first 8 bytes of the hash
+        const char *record; // nullptr for an empty slot
+    };
+
+    struct Shard
+    {
+        mutex lock;
+        vector<Slot> slots; // a power of two in size
+        size_t used;
+    };
+
+    size_t slab_size;
+
+    mutex slab_lock; // guards the slabs
+    vector<unique_ptr<char[]>> slabs;
+    size_t slab_used;     // bytes taken in the newest slab
+    size_t slab_capacity; // size of the newest slab
+    uint64_t slab_bytes;  // bytes of every slab together
+
+    vector<unique_ptr<Shard>> shards;
+
+    Shard &shard_for(const BlockHash &hash);
+    const char *find(Shard &shard, const BlockHash &hash);
+    char *allocate(size_t size);
+    static void place(vector<Slot> &slots, const Slot &slot);
+};
+
+#endif // ARENABLOCKSTORE_HPP
@@ -0,0 +1,286 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <string>
+
+#include "logger.hpp"
+#include "BlockCache.hpp"
+
+using namespace std;
+
+static const string TMP_SUFFIX = ".tmp";
+
+// the names of the entries in dir, skipping . and ..
+static vector<string> list_dir(const string &dir)
+{
+    vector<string> names;
+    DIR *dirp = opendir(dir.c_str());
+    if (dirp == NULL)
+    {
+        return names;
+    }
+    struct dirent *dp;
+    while ((dp = readdir(dirp)) != NULL)
+    {
+        string name = dp->d_name;
+        if (name != "." && name != "..")
+        {
+            names.push_back(name);
+        }
+    }
+    closedir(dirp);
+    return names;
+}
+
+BlockCache::BlockCache(const string &t_dir, uint64_t t_capacity, const BlockHasher &t_hasher)
+    : dir(t_dir), capacity(t_capacity), hasher(t_hasher), hand(0), used(0),
+      cache_hits(0), local_hits(0), misses(0), cache_bytes(0), local_bytes(0)
+{
+}
+
+void BlockCache::open()
+{
+    auto log = logger();
+
+    if (capacity == 0)
+    {
+        return;
+    }
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        log->error("Unable to create block cache {}: {}. Caching nothing.", dir, strerror(errno));
+        capacity = 0;
+        return;
+    }
+
+    lock_guard<mutex> guard(lock);
+    for (const string &sub : list_dir(dir))
+    {
+        for (const string &name : list_dir(dir + "/" + sub))
+        {
+            string path = dir + "/" + sub + "/" + name;
+            BlockHash hash;
+            struct stat st;
+            if (name.size() != 2 * BlockHash::SIZE || !BlockHash::from_wire(name, hash) || stat(path.c_str(), &st) != 0)
+            {
+                // a write an earlier run did not finish
+                unlink(path.c_str());
+                continue;
+            }
+            insert(hash, st.st_size);
+        }
+    }
+
+    // the capacity may have shrunk since the last run
+    evict(0);
+    log->info("Block cache {} holds {} blocks, {:.1f} of {:.1f} MB", dir, entries.size(), used / 1e6, capacity / 1e6);
+}
+
+void BlockCache::add_local(const BlockHash &hash, const string &path, uint64_t offset, size_t length)
+{
+    lock_guard<mutex> guard(lock);
+    local.insert(make_pair(hash, LocalBlock{path, offset, length}));
+}
+
+bool BlockCache::get(const BlockHash &hash, string &block)
+{
+    auto log = logger();
+
+    bool cached = false;
+    uint64_t length = 0;
+    {
+        lock_guard<mutex> guard(lock);
+        auto it = entries.find(hash);
+        if (it != entries.end())
+        {
+            it->second.referenced = true;
+            cached = true;
+            length = it->second.length;
+        }
+    }
+    if (cached)
+    {
+        if (read_verified(hash, entry_path(hash), 0, length, block))
+        {
+            lock_guard<mutex> guard(lock);
+            ++cache_hits;
+            cache_bytes += block.size();
+            return true;
+        }
+        log->error("Cached block {} is damaged, dropping it", hash.hex());
+        lock_guard<mutex> guard(lock);
+        remove(hash);
+    }
+
+    LocalBlock from;
+    {
+        lock_guard<mutex> guard(lock);
+        auto it = local.find(hash);
+        if (it == local.end())
+        {
+            ++misses;
+            return false;
+        }
+        from = it->second;
+    }
+    bool ok = read_verified(hash, from.path, from.offset, from.length, block);
+
+    lock_guard<mutex> guard(lock);
+    if (!ok)
+    {
+        // the file changed since it was indexed
+        local.erase(hash);
+        ++misses;
+        return false;
+    }
+    ++local_hits;
+    local_bytes += block.size();
+    return true;
+}
+
+void BlockCache::put(const BlockHash &hash, const string &block)
+{
+    auto log = logger();
+
+    {
+        lock_guard<mutex> guard(lock);
+        // capacity 0 is the cache turned off, or its directory missing;
+        // empty blocks would fit it otherwise
+        if (capacity == 0 || block.size() > capacity || entries.count(hash) > 0)
+        {
+            return;
+        }
+    }
+
+    // Write the block under a temporary name and rename it into place, so a
+    // crash never leaves a truncated entry behind. O_EXCL also keeps two
+    // threads fetching the same block from writing it at once.
+    string path = entry_path(hash);
+    string tmp = path + TMP_SUFFIX;
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == ENOENT)
+    {
+        mkdir(path.substr(0, path.rfind('/')).c_str(), 0755);
+        fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd < 0)
+    {
+        if (errno != EEXIST)
+        {
+            log->error("Unable to cache block {}: {}", hash.hex(), strerror(errno));
+        }
+        return;
+    }
+    bool ok = ::write(fd, block.data(), block.size()) == (ssize_t)block.size();
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        log->error("Unable to cache block {}: {}", hash.hex(), strerror(errno));
+        unlink(tmp.c_str());
+        return;
+    }
+
+    lock_guard<mutex> guard(lock);
+    evict(block.size());
+    insert(hash, block.size());
+}
+
+void BlockCache::report()
+{
+    auto log = logger();
+    lock_guard<mutex> guard(lock);
+
+    size_t hits = cache_hits + local_hits;
+    size_t lookups = hits + misses;
+    log->error("Block cache hit {} of {} blocks ({:.1f}%): {} from the cache, {} from local files; "
+               "{:.1f} MB not fetched ({:.1f} MB from the cache, {:.1f} MB from local files)",
+               hits, lookups, lookups > 0 ? 100.0 * hits / lookups : 0.0, cache_hits, local_hits,
+               (cache_bytes + local_bytes) / 1e6, cache_bytes / 1e6, local_bytes / 1e6);
+}
+
+// dir/ab/abcd... for a hash starting with ab
+string BlockCache::entry_path(const BlockHash &hash)
+{
+    string hex = hash.hex();
+    return dir + "/" + hex.substr(0, 2) + "/" + hex;
+}
+
+bool BlockCache::read_verified(const BlockHash &hash, const string &path, uint64_t offset, size_t length, string &block)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    block.resize(length);
+    bool ok = length == 0 || pread(fd, &block[0], length, offset) == (ssize_t)length;
+    close(fd);
+
+    BlockHash actual;
+    if (ok)
+    {
+        hasher.hash(block, actual);
+    }
+    return ok && actual == hash;
+}
+
+// add an entry for a block already on disk; lock must be held
+void BlockCache::insert(const BlockHash &hash, uint64_t length)
+{
+    if (entries.count(hash) > 0)
+    {
+        return;
+    }
+    entries[hash] = Entry{length, clock.size(), false};
+    clock.push_back(hash);
+    used += length;
+}
+
+// drop an entry and its file; lock must be held
+void BlockCache::remove(const BlockHash &hash)
+{
+    auto it = entries.find(hash);
+    if (it == entries.end())
+    {
+        return;
+    }
+
+    // fill the hole with the last slot, so clock stays dense
+    size_t slot = it->second.slot;
+    clock[slot] = clock.back();
+    entries[clock[slot]].slot = slot;
+    clock.pop_back();
+
+    used -= it->second.length;
+    unlink(entry_path(hash).c_str());
+    entries.erase(it);
+}
+
+// evict entries until length more bytes fit; lock must be held
+void BlockCache::evict(uint64_t length)
+{
+    while (!clock.empty() && used + length > capacity)
+    {
+        if (hand >= clock.size())
+        {
+            hand = 0;
+        }
+        Entry &entry = entries[clock[hand]];
+        if (entry.referenced)
+        {
+            entry.referenced = false;
+            ++hand;
+        }
+        else
+        {
+            // the last entry moves into this slot, and is looked at next
+            BlockHash victim = clock[hand];
+            remove(victim);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef BLOCKCACHE_HPP
+#define BLOCKCACHE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "logger.hpp"
+#include "BlockHash.hpp"
+#include "BlockHasher.hpp"
+
+using namespace std;
+
+/**
+ * A content-addressed block cache on the downloader host, kept between runs.
+ *
+ * Every block the downloader fetches is also written to dir, one file per
+ * block named after its hash (dir/ab/abcd...), and the next run looks a
+ * block up here before asking any server for it. The cache holds at most
+ * capacity bytes of blocks; once it is full, CLOCK picks what to evict: a
+ * hand sweeps over the entries, clears the referenced bit of each entry
+ * read since the hand last passed, and evicts the first entry whose bit is
+ * already clear. That approximates LRU without reordering anything on a hit.
+ *
+ * Blocks of files that are already on disk can be served too: add_local()
+ * remembers where a block sits in such a file, and get() reads it from
+ * there. Those files may change under us (the downloader replaces them), so
+ * every block get() returns, from either source, is hashed again and
+ * dropped if it no longer matches.
+ *
+ * get() and put() may be called from several threads at once.
+ */
+class BlockCache
+{
+  public:
+    // capacity 0 turns off the on-disk cache; local files still work
+    BlockCache(const string &t_dir, uint64_t t_capacity, const BlockHasher &t_hasher);
+
+    // create dir, and pick up the blocks earlier runs left in it
+    void open();
+
+    // remember that the length bytes at offset in path hold the block with hash
+    void add_local(const BlockHash &hash, const string &path, uint64_t offset, size_t length);
+
+    // copy the block with hash into block. False, counting a miss, if neither
+    // the cache nor a local file has it.
+    bool get(const BlockHash &hash, string &block);
+
+    // keep a fetched block, evicting others to make room
+    void put(const BlockHash &hash, const string &block);
+
+    // log the hit ratio and the bytes not fetched
+    void report();
+
+  protected:
+    struct Entry
+    {
+        uint64_t length;
+        size_t slot; // position in clock
+        bool referenced;
+    };
+
+    struct LocalBlock
+    {
+        string path;
+        uint64_t offset;
+        size_t length;
+    };
+
+    string dir;
+    uint64_t capacity;
+    const BlockHasher &hasher;
+
+    mutex lock; // guards everything below
+    unordered_map<BlockHash, Entry> entries;
+    vector<BlockHash> clock; // every entry, in no particular order
+    size_t hand;
+    uint64_t used; // bytes of blocks in the cache
+    unordered_map<BlockHash, LocalBlock> local;
+
+    size_t cache_hits;
+    size_t local_hits;
+    size_t misses;
+    uint64_t cache_bytes; // bytes served from the cache
+    uint64_t local_bytes; // bytes served from local files
+
+    string entry_path(const BlockHash &hash);
+    bool read_verified(const BlockHash &hash, const string &path, uint64_t offset, size_t length, string &block);
+    void insert(const BlockHash &hash, uint64_t length);
+    void remove(const BlockHash &hash);
+    void evict(uint64_t length);
+};
+
+#endif // BLOCKCACHE_HPP
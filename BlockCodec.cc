@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include <lz4.h>
+#include <zstd.h>
+
+#include "BlockCodec.hpp"
+
+using namespace std;
+
+// no real block comes anywhere near this; a larger length means the
+// payload is corrupt, and allocating for it would only hurt
+static const size_t MAX_BLOCK_SIZE = (size_t)1 << 30;
+
+static const size_t LZ4_HEADER_SIZE = 4;
+
+// zstd contexts hold a few hundred KB of tables, far too much to set up for
+// every block, so each thread keeps one of each for its lifetime
+struct ZstdContexts
+{
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+
+    ZstdContexts() : cctx(nullptr), dctx(nullptr) {}
+    ~ZstdContexts()
+    {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+};
+
+static thread_local ZstdContexts zstd_contexts;
+
+const char *BlockCodec::name(Codec codec)
+{
+    switch (codec)
+    {
+    case LZ4:
+        return "lz4";
+    case ZSTD:
+        return "zstd";
+    default:
+        return "none";
+    }
+}
+
+bool BlockCodec::parse(const string &name, Codec &codec)
+{
+    if (name == "none")
+    {
+        codec = NONE;
+    }
+    else if (name == "lz4")
+    {
+        codec = LZ4;
+    }
+    else if (name == "zstd")
+    {
+        codec = ZSTD;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+BlockCodec::BlockCodec(Codec t_codec, int t_level)
+    : used(t_codec), level(t_level)
+{
+}
+
+BlockCodec::Codec BlockCodec::encode(const string &block, string &out) const
+{
+    out.clear();
+    if (used == NONE || block.empty() || block.size() > MAX_BLOCK_SIZE)
+    {
+        return NONE;
+    }
+
+    // Compress into a buffer only as large as the block itself: if the
+    // result does not fit, it would not have been worth sending.
+    out.resize(block.size());
+    size_t length = 0;
+    if (used == LZ4)
+    {
+        if (block.size() <= LZ4_HEADER_SIZE)
+        {
+            out.clear();
+            return NONE;
+        }
+        uint32_t raw = (uint32_t)block.size();
+        for (size_t i = 0; i < LZ4_HEADER_SIZE; ++i)
+        {
+            out[i] = (char)(raw >> (8 * i));
+        }
+        int n = LZ4_compress_default(block.data(), &out[LZ4_HEADER_SIZE], (int)block.size(),
+                                     (int)(block.size() - LZ4_HEADER_SIZE));
+        length = n > 0 ? LZ4_HEADER_SIZE + n : 0;
+    }
+    else
+    {
+        if (zstd_contexts.cctx == nullptr)
+        {
+            zstd_contexts.cctx = ZSTD_createCCtx();
+        }
+        size_t n = ZSTD_compressCCtx(zstd_contexts.cctx, &out[0], out.size(), block.data(), block.size(), level);
+        length = ZSTD_isError(n) ? 0 : n;
+    }
+
+    if (length == 0 || length >= block.size())
+    {
+        out.clear();
+        return NONE;
+    }
+    out.resize(length);
+    return used;
+}
+
+bool BlockCodec::decode(Codec codec, const char *data, size_t length, string &out)
+{
+    if (codec == NONE)
+    {
+        out.assign(data, length);
+        return true;
+    }
+
+    if (codec == LZ4)
+    {
+        if (length < LZ4_HEADER_SIZE)
+        {
+            return false;
+        }
+        size_t raw = 0;
+        for (size_t i = 0; i < LZ4_HEADER_SIZE; ++i)
+        {
+            raw |= (size_t)(uint8_t)data[i] << (8 * i);
+        }
+        if (raw > MAX_BLOCK_SIZE)
+        {
+            return false;
+        }
+        out.resize(raw);
+        int n = LZ4_decompress_safe(data + LZ4_HEADER_SIZE, &out[0], (int)(length - LZ4_HEADER_SIZE), (int)raw);
+        return n >= 0 && (size_t)n == raw;
+    }
+
+    if (codec == ZSTD)
+    {
+        unsigned long long raw = ZSTD_getFrameContentSize(data, length);
+        if (raw == ZSTD_CONTENTSIZE_UNKNOWN || raw == ZSTD_CONTENTSIZE_ERROR || raw > MAX_BLOCK_SIZE)
+        {
+            return false;
+        }
+        if (zstd_contexts.dctx == nullptr)
+        {
+            zstd_contexts.dctx = ZSTD_createDCtx();
+        }
+        out.resize(raw);
+        size_t n = ZSTD_decompressDCtx(zstd_contexts.dctx, &out[0], out.size(), data, length);
+        return !ZSTD_isError(n) && n == raw;
+    }
+
+    return false;
+}
@@ -0,0 +1,59 @@
+#ifndef BLOCKCODEC_HPP
+#define BLOCKCODEC_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+using namespace std;
+
+/**
+ * Per-block compression.
+ *
+ * A block is sent and stored either as is (NONE) or compressed with one of
+ * the codecs below, and its codec travels next to it as one byte. Block
+ * hashes are always of the uncompressed bytes, so compression changes
+ * neither a file's hash list nor dedup.
+ *
+ *   lz4  - 4-byte little-endian block length, then an LZ4 block
+ *   zstd - a zstd frame, which records the block length itself
+ *
+ * encode() falls back to NONE for every block that does not shrink, so
+ * random data costs one failed compression attempt and nothing else. A
+ * codec is stateless apart from per-thread compression contexts, and may be
+ * shared by any number of threads.
+ */
+class BlockCodec
+{
+  public:
+    enum Codec
+    {
+        NONE = 0,
+        LZ4 = 1,
+        ZSTD = 2,
+    };
+
+    static const char *name(Codec codec);
+    // parse "none", "lz4" or "zstd"; false for anything else
+    static bool parse(const string &name, Codec &codec);
+    // whether byte is a codec this code can decode
+    static bool valid(uint8_t byte) { return byte <= ZSTD; }
+
+    // level only matters for zstd (1 to 19; 3 is zstd's own default)
+    BlockCodec(Codec t_codec, int t_level);
+
+    Codec codec() const { return used; }
+
+    // compress block into out. Returns the codec out is encoded with, or
+    // NONE (leaving out empty) if compressing would not make block smaller.
+    Codec encode(const string &block, string &out) const;
+
+    // decompress data, encoded with codec, into out. False if it is corrupt.
+    static bool decode(Codec codec, const char *data, size_t length, string &out);
+
+  protected:
+    Codec used;
+    int level;
+};
+
+#endif // BLOCKCODEC_HPP
@@ -0,0 +1,62 @@
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "BlockDigest.hpp"
+
+using namespace std;
+
+uint64_t BlockDigest::fingerprint(const BlockHash &hash)
+{
+    // big-endian, so it equals the value of the first 16 hex characters
+    uint64_t fp = 0;
+    for (size_t i = 0; i < sizeof(fp); ++i)
+    {
+        fp = fp << 8 | hash.bytes[i];
+    }
+    return fp;
+}
+
+string BlockDigest::build(const list<BlockHash> &hashes)
+{
+    vector<uint64_t> sorted;
+    sorted.reserve(hashes.size());
+    for (const BlockHash &hash : hashes)
+    {
+        sorted.push_back(fingerprint(hash));
+    }
+    sort(sorted.begin(), sorted.end());
+    sorted.erase(unique(sorted.begin(), sorted.end()), sorted.end());
+
+    return string((const char *)sorted.data(), sorted.size() * sizeof(uint64_t));
+}
+
+void BlockDigest::load(const string &serialized)
+{
+    fingerprints.clear();
+    add(serialized);
+}
+
+void BlockDigest::add(const string &serialized)
+{
+    size_t count = serialized.size() / sizeof(uint64_t);
+
+    fingerprints.reserve(fingerprints.size() + count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint64_t fp;
+        memcpy(&fp, serialized.data() + i * sizeof(uint64_t), sizeof(uint64_t));
+        fingerprints.insert(fp);
+    }
+}
+
+string BlockDigest::serialize() const
+{
+    vector<uint64_t> packed(fingerprints.begin(), fingerprints.end());
+    return string((const char *)packed.data(), packed.size() * sizeof(uint64_t));
+}
+
+bool BlockDigest::may_contain(const BlockHash &hash) const
+{
+    return fingerprints.count(fingerprint(hash)) != 0;
+}
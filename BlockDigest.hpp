@@ -0,0 +1,56 @@
+#ifndef BLOCKDIGEST_HPP
+#define BLOCKDIGEST_HPP
+
+#include <stdint.h>
+#include <list>
+#include <string>
+#include <unordered_set>
+
+#include "BlockHash.hpp"
+
+using namespace std;
+
+/**
+ * A compact summary of the blocks a SurfStoreServer holds.
+ *
+ * Instead of shipping every hash (as get_all_blocks_hashlist does, in hex),
+ * a server sends a 64-bit fingerprint of each hash: the big-endian value of
+ * the hash's first 8 bytes. The fingerprints go out sorted and packed in
+ * host byte order in one byte string, 8 bytes per block on the wire. The
+ * downloader loads them into a hash set for O(1) lookups.
+ *
+ * Two different hashes can share a fingerprint, so may_contain() can return
+ * a false positive (with 1M blocks, roughly a 1 in 10^13 chance per lookup).
+ * The downloader confirms presence by the reply itself: a server returns an
+ * empty block for a hash it does not have, which is then fetched from the
+ * next holder instead.
+ */
+class BlockDigest
+{
+  public:
+    // the fingerprint of a block hash
+    static uint64_t fingerprint(const BlockHash &hash);
+
+    // serialize the digest of a server's hashes (server side)
+    static string build(const list<BlockHash> &hashes);
+
+    // load a digest received from a server (client side)
+    void load(const string &serialized);
+
+    // add packed fingerprints, e.g. a get_blocks_since delta, to the digest
+    void add(const string &serialized);
+
+    // pack the fingerprints held, unsorted, e.g. to save them to disk
+    string serialize() const;
+
+    void clear() { fingerprints.clear(); }
+
+    bool may_contain(const BlockHash &hash) const;
+
+    size_t size() const { return fingerprints.size(); }
+
+  protected:
+    unordered_set<uint64_t> fingerprints;
+};
+
+#endif // BLOCKDIGEST_HPP
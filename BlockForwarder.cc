@@ -0,0 +1,214 @@
+#include <string>
+#include <vector>
+
+#include "BlockForwarder.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+BlockForwarder::BlockForwarder(const vector<string> &t_hosts, const vector<int> &t_ports, size_t t_max_bytes, size_t t_window,
+                               uint64_t t_timeout)
+    : hosts(t_hosts), ports(t_ports), max_bytes(t_max_bytes), window(t_window), timeout(t_timeout), peers(t_hosts.size()),
+      peer_generation(t_hosts.size(), 0),
+      queued_bytes(0), busy(0), sent_bytes(0), failed(0), stopping(false)
+{
+    sender = thread(&BlockForwarder::send_stage, this);
+}
+
+BlockForwarder::~BlockForwarder()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    sender.join();
+}
+
+void BlockForwarder::forward(int server, vector<pair<string, string>> &blocks, string &codecs, vector<vector<int>> &chains)
+{
+    Batch batch;
+    batch.server = server;
+    batch.blocks.swap(blocks);
+    batch.codecs.swap(codecs);
+    batch.chains.swap(chains);
+    batch.bytes = 0;
+    for (const pair<string, string> &block : batch.blocks)
+    {
+        batch.bytes += block.second.size();
+    }
+
+    {
+        // a batch larger than max_bytes still goes through, on its own. Two
+        // servers forwarding to each other may each be waiting for the
+        // other's reply, so the wait is cut short after a timeout.
+        unique_lock<mutex> guard(lock);
+        room.wait_for(guard, milliseconds(timeout),
+                      [&]() { return queued_bytes == 0 || queued_bytes + batch.bytes <= max_bytes; });
+        queued_bytes += batch.bytes;
+        queue.push_back(move(batch));
+    }
+    ready.notify_one();
+}
+
+void BlockForwarder::drain()
+{
+    unique_lock<mutex> guard(lock);
+    room.wait(guard, [&]() { return queue.empty() && busy == 0; });
+}
+
+size_t BlockForwarder::backlog_bytes()
+{
+    lock_guard<mutex> guard(lock);
+    return queued_bytes;
+}
+
+size_t BlockForwarder::forwarded_bytes()
+{
+    lock_guard<mutex> guard(lock);
+    return sent_bytes;
+}
+
+size_t BlockForwarder::failed_blocks()
+{
+    lock_guard<mutex> guard(lock);
+    return failed;
+}
+
+// the sender thread: send queued batches until stopping and all are answered
+void BlockForwarder::send_stage()
+{
+    auto log = logger();
+    deque<InFlight> in_flight;
+
+    for (;;)
+    {
+        while (!in_flight.empty() && in_flight.front().reply.wait_for(seconds(0)) == future_status::ready)
+        {
+            complete(in_flight.front());
+            in_flight.pop_front();
+        }
+        // batches go out in order with the same timeout, so the oldest
+        // expires first
+        while (!in_flight.empty() && steady_clock::now() >= in_flight.front().deadline)
+        {
+            expire(in_flight.front());
+            in_flight.pop_front();
+        }
+
+        Batch batch;
+        bool have = false;
+        {
+            unique_lock<mutex> guard(lock);
+            if (in_flight.empty())
+            {
+                ready.wait(guard, [&]() { return stopping || !queue.empty(); });
+            }
+            if (!queue.empty() && in_flight.size() < window)
+            {
+                batch = move(queue.front());
+                queue.pop_front();
+                ++busy;
+                have = true;
+            }
+            else if (queue.empty() && in_flight.empty())
+            {
+                return;
+            }
+        }
+
+        if (!have)
+        {
+            in_flight.front().reply.wait_for(milliseconds(1));
+            continue;
+        }
+
+        log->info("Forwarding {} blocks ({} bytes) to server #{}", batch.blocks.size(), batch.bytes, batch.server);
+        InFlight call;
+        call.server = batch.server;
+        call.blocks = batch.blocks.size();
+        call.bytes = batch.bytes;
+        call.connection = peer_generation[batch.server];
+        try
+        {
+            if (!peers[batch.server])
+            {
+                peers[batch.server].reset(new rpc::client(hosts[batch.server], ports[batch.server]));
+                peers[batch.server]->set_timeout(timeout);
+            }
+            call.reply = peers[batch.server]->async_call("store_chained_blocks", batch.blocks, batch.codecs, batch.chains);
+            call.deadline = steady_clock::now() + milliseconds(timeout);
+        }
+        catch (exception &e)
+        {
+            log->error("Forwarding to server #{} failed: {}", batch.server, e.what());
+            disconnect(call);
+            release(call, call.blocks);
+            continue;
+        }
+        in_flight.push_back(move(call));
+    }
+}
+
+void BlockForwarder::complete(InFlight &call)
+{
+    auto log = logger();
+
+    size_t lost = 0;
+    try
+    {
+        vector<bool> stored = call.reply.get().as<vector<bool>>();
+        for (size_t i = 0; i < call.blocks; ++i)
+        {
+            // false also means the peer already had the block
+            lost += i >= stored.size();
+        }
+    }
+    catch (exception &e)
+    {
+        log->error("store_chained_blocks to server #{} failed: {}", call.server, e.what());
+        lost = call.blocks;
+        disconnect(call);
+    }
+    release(call, lost);
+}
+
+// give up on a batch the peer has not answered in time
+void BlockForwarder::expire(InFlight &call)
+{
+    auto log = logger();
+
+    log->error("store_chained_blocks to server #{} timed out after {} ms", call.server, timeout);
+    disconnect(call);
+    release(call, call.blocks);
+}
+
+/**
+ * Drop the connection call went out on, so that the next batch to its peer
+ * reconnects. Batches still in flight on it fail with it, and must not drop
+ * the new connection in turn.
+ */
+void BlockForwarder::disconnect(const InFlight &call)
+{
+    if (call.connection == peer_generation[call.server])
+    {
+        peers[call.server].reset();
+        ++peer_generation[call.server];
+    }
+}
+
+// account for a batch that has been answered, lost blocks of it failing
+void BlockForwarder::release(const InFlight &call, size_t lost)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        queued_bytes -= call.bytes;
+        --busy;
+        failed += lost;
+        if (lost == 0)
+        {
+            sent_bytes += call.bytes;
+        }
+    }
+    room.notify_all();
+}
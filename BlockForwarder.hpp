@@ -0,0 +1,106 @@
+#ifndef BLOCKFORWARDER_HPP
+#define BLOCKFORWARDER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "rpc/client.h"
+
+#include "logger.hpp"
+
+using namespace std;
+
+/**
+ * Sends blocks from one SurfStoreServer to the others with
+ * store_chained_blocks (protocol version 6), in the background.
+ *
+ * forward() queues a batch for a peer and returns at once, unless the
+ * batches queued or in flight already add up to max_bytes, in which case it
+ * waits for room, for up to timeout: a server that cannot keep up slows its
+ * clients down rather than buffering much more. A single thread sends the batches
+ * in order, up to window of them in flight at once, each peer over a
+ * connection of its own, made when it is first needed.
+ *
+ * A batch that fails, or is not answered within timeout, is logged and
+ * counted, not retried; the blocks stay on this server only until the
+ * repairer copies them again. The peer's connection is then dropped, and
+ * made anew for its next batch, so a peer that restarts is not lost for
+ * good.
+ */
+class BlockForwarder
+{
+  public:
+    BlockForwarder(const vector<string> &t_hosts, const vector<int> &t_ports, size_t t_max_bytes, size_t t_window,
+                   uint64_t t_timeout);
+    ~BlockForwarder();
+
+    // send blocks, with codecs and chains as in store_chained_blocks, to
+    // server; takes the contents of all three
+    void forward(int server, vector<pair<string, string>> &blocks, string &codecs, vector<vector<int>> &chains);
+
+    // wait until every queued batch has been sent and answered
+    void drain();
+
+    // payload bytes queued or in flight, and forwarded so far
+    size_t backlog_bytes();
+    size_t forwarded_bytes();
+    size_t failed_blocks();
+
+  protected:
+    struct Batch
+    {
+        int server;
+        vector<pair<string, string>> blocks;
+        string codecs;
+        vector<vector<int>> chains;
+        size_t bytes;
+    };
+
+    struct InFlight
+    {
+        int server;
+        size_t blocks;
+        size_t bytes;
+        future<RPCLIB_MSGPACK::object_handle> reply;
+        chrono::steady_clock::time_point deadline; // async_call ignores set_timeout
+        uint64_t connection; // peer_generation[server] when sent
+    };
+
+    vector<string> hosts;
+    vector<int> ports;
+    size_t max_bytes;
+    size_t window;
+    uint64_t timeout; // milliseconds
+    vector<unique_ptr<rpc::client>> peers; // only touched by the sender thread
+    vector<uint64_t> peer_generation;      // connections dropped so far, per peer
+
+    // everything below is guarded by lock
+    mutex lock;
+    condition_variable ready; // a batch was queued, or stopping
+    condition_variable room;  // bytes were released
+    deque<Batch> queue;
+    size_t queued_bytes; // queued or in flight
+    size_t busy;         // batches taken off the queue and not yet answered
+    size_t sent_bytes;
+    size_t failed;
+    bool stopping;
+    thread sender;
+
+    void send_stage();
+    void complete(InFlight &call);
+    void expire(InFlight &call);
+    void disconnect(const InFlight &call);
+    void release(const InFlight &call, size_t lost);
+};
+
+#endif // BLOCKFORWARDER_HPP
@@ -0,0 +1,125 @@
+#ifndef BLOCKHASH_HPP
+#define BLOCKHASH_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * The SHA-256 of a block, as 32 raw bytes.
+ *
+ * A plain, trivially copyable value: it fits in half a cache line, compares
+ * with memcmp, and needs no heap allocation, unlike the 64-char hex strings
+ * the original protocol used. Hex is only produced at the edges, for logs
+ * and for peers that speak protocol version 1.
+ */
+struct BlockHash
+{
+    static const size_t SIZE = 32;
+
+    uint8_t bytes[SIZE];
+
+    // 64 lowercase hex characters
+    string hex() const
+    {
+        static const char digits[] = "0123456789abcdef";
+        string out(2 * SIZE, '0');
+        for (size_t i = 0; i < SIZE; ++i)
+        {
+            out[2 * i] = digits[bytes[i] >> 4];
+            out[2 * i + 1] = digits[bytes[i] & 0xf];
+        }
+        return out;
+    }
+
+    // the 32 raw bytes, as sent on the wire by protocol version 2
+    string raw() const { return string((const char *)bytes, SIZE); }
+
+    /**
+     * Parse a hash as it arrives over RPC: 32 raw bytes (protocol 2) or 64
+     * hex characters (protocol 1). Returns false for anything else.
+     */
+    static bool from_wire(const string &wire, BlockHash &hash)
+    {
+        if (wire.size() == SIZE)
+        {
+            memcpy(hash.bytes, wire.data(), SIZE);
+            return true;
+        }
+        if (wire.size() != 2 * SIZE)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < SIZE; ++i)
+        {
+            int hi = hex_digit(wire[2 * i]), lo = hex_digit(wire[2 * i + 1]);
+            if (hi < 0 || lo < 0)
+            {
+                return false;
+            }
+            hash.bytes[i] = (uint8_t)(hi << 4 | lo);
+        }
+        return true;
+    }
+
+    static BlockHash from_hex(const string &hex)
+    {
+        BlockHash hash = BlockHash();
+        from_wire(hex, hash);
+        return hash;
+    }
+
+    // concatenate hashes into one string of 32-byte entries, and back
+    static string pack(const vector<BlockHash> &hashes)
+    {
+        return hashes.empty() ? string() : string((const char *)hashes.data(), hashes.size() * SIZE);
+    }
+
+    static vector<BlockHash> unpack(const string &packed)
+    {
+        vector<BlockHash> hashes(packed.size() / SIZE);
+        if (!hashes.empty())
+        {
+            memcpy(hashes.data(), packed.data(), hashes.size() * SIZE);
+        }
+        return hashes;
+    }
+
+    bool operator==(const BlockHash &other) const { return memcmp(bytes, other.bytes, SIZE) == 0; }
+    bool operator!=(const BlockHash &other) const { return !(*this == other); }
+    bool operator<(const BlockHash &other) const { return memcmp(bytes, other.bytes, SIZE) < 0; }
+
+  private:
+    static int hex_digit(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+};
+
+namespace std
+{
+// SHA-256 output is uniformly distributed, so its first 8 bytes already
+// make a good hash value
+template <>
+struct hash<BlockHash>
+{
+    size_t operator()(const BlockHash &h) const
+    {
+        uint64_t prefix;
+        memcpy(&prefix, h.bytes, sizeof(prefix));
+        return (size_t)prefix;
+    }
+};
+} // namespace std
+
+#endif // BLOCKHASH_HPP
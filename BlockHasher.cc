@@ -0,0 +1,401 @@
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define BLOCKHASHER_X86 1
+#endif
+
+#include "picosha2/picosha2.h"
+
+#include "BlockHasher.hpp"
+
+using namespace std;
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+/**
+ * Build the last one or two 64-byte blocks of a len byte message in tail:
+ * its trailing len % 64 bytes, the 0x80 terminator, zeros and the message
+ * length in bits. Returns how many blocks that is.
+ */
+static size_t pad_tail(const uint8_t *data, size_t len, uint8_t tail[128])
+{
+    size_t rem = len % 64;
+    size_t blocks = rem < 56 ? 1 : 2;
+
+    memset(tail, 0, blocks * 64);
+    memcpy(tail, data + len - rem, rem);
+    tail[rem] = 0x80;
+    uint64_t bits = (uint64_t)len * 8;
+    for (size_t i = 0; i < 8; ++i)
+    {
+        tail[blocks * 64 - 1 - i] = (uint8_t)(bits >> (8 * i));
+    }
+    return blocks;
+}
+
+static void store_digest(const uint32_t state[8], BlockHash &out)
+{
+    for (size_t i = 0; i < 8; ++i)
+    {
+        out.bytes[4 * i] = (uint8_t)(state[i] >> 24);
+        out.bytes[4 * i + 1] = (uint8_t)(state[i] >> 16);
+        out.bytes[4 * i + 2] = (uint8_t)(state[i] >> 8);
+        out.bytes[4 * i + 3] = (uint8_t)state[i];
+    }
+}
+
+#ifdef BLOCKHASHER_X86
+
+/**
+ * Run the SHA-256 compression function over blocks 64-byte blocks with the
+ * SHA extensions. The state is kept as ABEF/CDGH, the layout sha256rnds2
+ * works on, and each loop iteration does four rounds.
+ */
+__attribute__((target("sha,sse4.1")))
+static void compress_shani(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+    const __m128i BSWAP = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1); // CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b); // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);      // CDGH
+
+    for (; blocks > 0; --blocks, data += 64)
+    {
+        __m128i abef = state0, cdgh = state1;
+        __m128i msg[4];
+
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; ++i)
+        {
+            __m128i &cur = msg[i % 4];
+            if (i < 4)
+            {
+                cur = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * i)), BSWAP);
+            }
+
+            __m128i wk = _mm_add_epi32(cur, _mm_loadu_si128((const __m128i *)&K[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+
+            // extend the schedule: w[t+16..t+19] from w[t..t+15]
+            if (i >= 3 && i < 15)
+            {
+                __m128i &next = msg[(i + 1) % 4];
+                next = _mm_add_epi32(next, _mm_alignr_epi8(cur, msg[(i + 3) % 4], 4));
+                next = _mm_sha256msg2_epu32(next, cur);
+            }
+
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0e));
+
+            if (i >= 1 && i < 13)
+            {
+                __m128i &prev = msg[(i + 3) % 4];
+                prev = _mm_sha256msg1_epu32(prev, cur);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);    // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1); // DCHG
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xf0)); // DCBA
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));    // HGFE
+}
+
+static void hash_shani(const string &block, BlockHash &out)
+{
+    const uint8_t *data = (const uint8_t *)block.data();
+    uint32_t state[8];
+    uint8_t tail[128];
+    memcpy(state, H0, sizeof(state));
+
+    compress_shani(state, data, block.size() / 64);
+    compress_shani(state, tail, pad_tail(data, block.size(), tail));
+    store_digest(state, out);
+}
+
+#define ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+/**
+ * Hash eight messages of len bytes each at once, message j in 32-bit lane j
+ * of every AVX2 register. Their schedules and rounds are computed exactly
+ * as in scalar code, eight at a time.
+ */
+__attribute__((target("avx2")))
+static void hash8_avx2(const uint8_t *const data[8], size_t len, uint32_t digests[8][8])
+{
+    uint8_t tails[8][128];
+    size_t tail_blocks = 0;
+    for (size_t lane = 0; lane < 8; ++lane)
+    {
+        tail_blocks = pad_tail(data[lane], len, tails[lane]);
+    }
+
+    __m256i state[8];
+    for (size_t i = 0; i < 8; ++i)
+    {
+        state[i] = _mm256_set1_epi32((int)H0[i]);
+    }
+
+    size_t full_blocks = len / 64;
+    for (size_t block = 0; block < full_blocks + tail_blocks; ++block)
+    {
+        const uint8_t *p[8];
+        for (size_t lane = 0; lane < 8; ++lane)
+        {
+            p[lane] = block < full_blocks ? data[lane] + 64 * block : tails[lane] + 64 * (block - full_blocks);
+        }
+
+        // w[t] of every lane, byte swapped to big-endian
+        __m256i w[16];
+        for (size_t t = 0; t < 16; ++t)
+        {
+            uint32_t words[8];
+            for (size_t lane = 0; lane < 8; ++lane)
+            {
+                memcpy(&words[lane], p[lane] + 4 * t, 4);
+                words[lane] = __builtin_bswap32(words[lane]);
+            }
+            w[t] = _mm256_loadu_si256((const __m256i *)words);
+        }
+
+        __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+        __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+        for (size_t t = 0; t < 64; ++t)
+        {
+            if (t >= 16)
+            {
+                __m256i w15 = w[(t - 15) % 16], w2 = w[(t - 2) % 16];
+                __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR(w15, 7), ROTR(w15, 18)), _mm256_srli_epi32(w15, 3));
+                __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR(w2, 17), ROTR(w2, 19)), _mm256_srli_epi32(w2, 10));
+                w[t % 16] = _mm256_add_epi32(_mm256_add_epi32(w[t % 16], s0), _mm256_add_epi32(w[(t - 7) % 16], s1));
+            }
+
+            __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(ROTR(e, 6), ROTR(e, 11)), ROTR(e, 25));
+            __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, S1), _mm256_add_epi32(ch, w[t % 16]));
+            t1 = _mm256_add_epi32(t1, _mm256_set1_epi32((int)K[t]));
+
+            __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(ROTR(a, 2), ROTR(a, 13)), ROTR(a, 22));
+            __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+            __m256i t2 = _mm256_add_epi32(S0, maj);
+
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(t1, t2);
+        }
+
+        state[0] = _mm256_add_epi32(state[0], a);
+        state[1] = _mm256_add_epi32(state[1], b);
+        state[2] = _mm256_add_epi32(state[2], c);
+        state[3] = _mm256_add_epi32(state[3], d);
+        state[4] = _mm256_add_epi32(state[4], e);
+        state[5] = _mm256_add_epi32(state[5], f);
+        state[6] = _mm256_add_epi32(state[6], g);
+        state[7] = _mm256_add_epi32(state[7], h);
+    }
+
+    for (size_t i = 0; i < 8; ++i)
+    {
+        uint32_t words[8];
+        _mm256_storeu_si256((__m256i *)words, state[i]);
+        for (size_t lane = 0; lane < 8; ++lane)
+        {
+            digests[lane][i] = words[lane];
+        }
+    }
+}
+
+#undef ROTR
+
+// up to eight blocks of the same size; unused lanes repeat the first block
+static void hash_avx2(const vector<const string *> &blocks, const vector<BlockHash *> &out)
+{
+    const uint8_t *data[8];
+    for (size_t lane = 0; lane < 8; ++lane)
+    {
+        data[lane] = (const uint8_t *)blocks[lane < blocks.size() ? lane : 0]->data();
+    }
+
+    uint32_t digests[8][8];
+    hash8_avx2(data, blocks[0]->size(), digests);
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        store_digest(digests[i], *out[i]);
+    }
+}
+
+#endif // BLOCKHASHER_X86
+
+BlockHasher::Engine BlockHasher::detect()
+{
+    if (supported(SHANI))
+    {
+        return SHANI;
+    }
+    if (supported(AVX2))
+    {
+        return AVX2;
+    }
+    return SCALAR;
+}
+
+bool BlockHasher::supported(Engine engine)
+{
+    if (engine == SCALAR)
+    {
+        return true;
+    }
+#ifdef BLOCKHASHER_X86
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return false;
+    }
+    unsigned int features1 = ecx;
+    if (__get_cpuid_max(0, nullptr) < 7)
+    {
+        return false;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    unsigned int features7 = ebx;
+
+    if (engine == SHANI)
+    {
+        return (features1 & bit_SSSE3) && (features1 & bit_SSE4_1) && (features7 & bit_SHA);
+    }
+
+    // AVX2 also needs the OS to save the upper halves of the registers
+    if (!(features1 & bit_OSXSAVE) || !(features1 & bit_AVX) || !(features7 & bit_AVX2))
+    {
+        return false;
+    }
+    uint32_t xcr0, xcr0_high;
+    __asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+    return (xcr0 & 6) == 6;
+#else
+    return false;
+#endif
+}
+
+const char *BlockHasher::name(Engine engine)
+{
+    switch (engine)
+    {
+    case SHANI:
+        return "shani";
+    case AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+bool BlockHasher::parse(const string &name, Engine &engine)
+{
+    if (name == "auto")
+    {
+        engine = detect();
+    }
+    else if (name == "shani")
+    {
+        engine = SHANI;
+    }
+    else if (name == "avx2")
+    {
+        engine = AVX2;
+    }
+    else if (name == "scalar")
+    {
+        engine = SCALAR;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+BlockHasher::BlockHasher(Engine t_engine)
+    : used(supported(t_engine) ? t_engine : SCALAR)
+{
+}
+
+void BlockHasher::hash(const string &block, BlockHash &out) const
+{
+#ifdef BLOCKHASHER_X86
+    if (used == SHANI)
+    {
+        hash_shani(block, out);
+        return;
+    }
+    if (used == AVX2)
+    {
+        hash_avx2(vector<const string *>(1, &block), vector<BlockHash *>(1, &out));
+        return;
+    }
+#endif
+    picosha2::hash256(block.begin(), block.end(), out.bytes, out.bytes + BlockHash::SIZE);
+}
+
+void BlockHasher::hash_many(const vector<const string *> &blocks, const vector<BlockHash *> &out) const
+{
+#ifdef BLOCKHASHER_X86
+    if (used == AVX2)
+    {
+        // lanes must hash messages of the same length
+        map<size_t, pair<vector<const string *>, vector<BlockHash *>>> by_size;
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            auto &group = by_size[blocks[i]->size()];
+            group.first.push_back(blocks[i]);
+            group.second.push_back(out[i]);
+            if (group.first.size() == 8)
+            {
+                hash_avx2(group.first, group.second);
+                group.first.clear();
+                group.second.clear();
+            }
+        }
+        for (auto const &group : by_size)
+        {
+            if (!group.second.first.empty())
+            {
+                hash_avx2(group.second.first, group.second.second);
+            }
+        }
+        return;
+    }
+#endif
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        hash(*blocks[i], *out[i]);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef BLOCKHASHER_HPP
+#define BLOCKHASHER_HPP
+
+#include <string>
+#include <vector>
+
+#include "BlockHash.hpp"
+
+using namespace std;
+
+/**
+ * SHA-256 of blocks, using the fastest implementation the CPU supports.
+ *
+ *   shani  - the x86 SHA extensions, one block at a time
+ *   avx2   - eight equally sized blocks at once, one per 32-bit AVX2 lane
+ *   scalar - picosha2, on any CPU
+ *
+ * "auto" picks the first of these the CPU (and OS) supports, checked with
+ * cpuid at runtime, so one binary runs everywhere. A hasher is stateless
+ * and may be shared by any number of threads.
+ */
+class BlockHasher
+{
+  public:
+    enum Engine
+    {
+        SCALAR,
+        AVX2,
+        SHANI,
+    };
+
+    // the best engine this machine supports
+    static Engine detect();
+    static bool supported(Engine engine);
+    static const char *name(Engine engine);
+    // parse "auto", "shani", "avx2" or "scalar"; false for anything else
+    static bool parse(const string &name, Engine &engine);
+
+    explicit BlockHasher(Engine t_engine);
+
+    Engine engine() const { return used; }
+
+    // how many blocks hash_many() works on at once
+    size_t lanes() const { return used == AVX2 ? 8 : 1; }
+
+    void hash(const string &block, BlockHash &out) const;
+
+    // out[i] = SHA-256 of *blocks[i], for every i
+    void hash_many(const vector<const string *> &blocks, const vector<BlockHash *> &out) const;
+
+  protected:
+    Engine used;
+};
+
+#endif // BLOCKHASHER_HPP
@@ -0,0 +1,37 @@
+#include <random>
+#include <chrono>
+
+#include "BlockDigest.hpp"
+#include "BlockInventory.hpp"
+
+using namespace std;
+
+BlockInventory::BlockInventory()
+{
+    random_device rd;
+    mt19937_64 rng(((uint64_t)rd() << 32) ^ chrono::high_resolution_clock::now().time_since_epoch().count());
+    do
+    {
+        epoch = rng();
+    } while (epoch == 0); // 0 means "no epoch" to clients
+}
+
+uint64_t BlockInventory::add(const BlockHash &hash)
+{
+    lock_guard<mutex> guard(lock);
+    fingerprints.push_back(BlockDigest::fingerprint(hash));
+    return fingerprints.size() - 1;
+}
+
+tuple<uint64_t, uint64_t, string> BlockInventory::since(uint64_t client_epoch, uint64_t seq)
+{
+    lock_guard<mutex> guard(lock);
+
+    if (client_epoch != epoch || seq > fingerprints.size())
+    {
+        seq = 0;
+    }
+
+    string packed((const char *)(fingerprints.data() + seq), (fingerprints.size() - seq) * sizeof(uint64_t));
+    return make_tuple(epoch, (uint64_t)fingerprints.size(), packed);
+}
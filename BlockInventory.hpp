@@ -0,0 +1,48 @@
+#ifndef BLOCKINVENTORY_HPP
+#define BLOCKINVENTORY_HPP
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "BlockHash.hpp"
+
+using namespace std;
+
+/**
+ * The order in which a SurfStoreServer has stored its blocks.
+ *
+ * Every stored block gets the next sequence number (starting from 0), and
+ * the inventory remembers the block's BlockDigest fingerprint under it. A
+ * client that has already seen sequence numbers [0, seq) can then ask for
+ * just the blocks stored since, making a repeated sync cost proportional to
+ * the churn rather than to everything the server holds.
+ *
+ * Sequence numbers are only meaningful within one epoch, a random number
+ * drawn when the server starts: blocks may be gone or renumbered after a
+ * restart, so a client holding an older epoch gets a full resync.
+ */
+class BlockInventory
+{
+  public:
+    BlockInventory();
+
+    // record a newly stored block; returns its sequence number
+    uint64_t add(const BlockHash &hash);
+
+    // (epoch, next_seq, packed fingerprints of the blocks with sequence
+    // numbers in [seq, next_seq)). A client_epoch other than ours restarts
+    // from 0.
+    tuple<uint64_t, uint64_t, string> since(uint64_t client_epoch, uint64_t seq);
+
+    uint64_t get_epoch() const { return epoch; }
+
+  protected:
+    uint64_t epoch;
+    mutex lock;
+    vector<uint64_t> fingerprints; // indexed by sequence number
+};
+
+#endif // BLOCKINVENTORY_HPP
@@ -0,0 +1,279 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.hpp"
+#include "BlockPipeline.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+BlockPipeline::BlockPipeline(size_t t_blocksize, size_t t_ring_blocks, const BlockHasher &t_hasher, size_t t_hash_threads,
+                             const Chunker *t_chunker, const BlockCodec &t_codec)
+    : blocksize(t_blocksize), ring(t_ring_blocks), hasher(t_hasher), hash_threads(t_hash_threads), chunker(t_chunker),
+      codec(t_codec), failed(false), hash_next(0), hash_finished(false),
+      read_time(high_resolution_clock::duration::zero()), hash_time(high_resolution_clock::duration::zero()),
+      compress_time(high_resolution_clock::duration::zero()), consume_time(high_resolution_clock::duration::zero()),
+      run_time(high_resolution_clock::duration::zero()), bytes(0), blocks(0), encoded_bytes(0), blocks_shrunk(0)
+{
+}
+
+bool BlockPipeline::run(const string &path, const Consumer &consume)
+{
+    auto log = logger();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        log->error("error reading file '{}': {}", path, strerror(errno));
+        return false;
+    }
+    // we read front to back exactly once
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    auto start = high_resolution_clock::now();
+    failed = false;
+    hash_next = 0;
+    hash_finished = false;
+    for (Slot &slot : ring)
+    {
+        slot.state = FREE;
+        slot.last = false;
+    }
+
+    thread reader(chunker ? &BlockPipeline::read_chunks : &BlockPipeline::read_stage, this, fd);
+    vector<thread> hashers;
+    for (size_t i = 0; i < hash_threads; ++i)
+    {
+        hashers.push_back(thread(&BlockPipeline::hash_stage, this));
+    }
+
+    for (size_t seq = 0;; ++seq)
+    {
+        Slot &slot = wait_for(seq, HASHED);
+        bool last = slot.last;
+        bool skip;
+        {
+            lock_guard<mutex> guard(lock);
+            skip = last && failed; // the slot reading failed on holds no block
+        }
+
+        if (!skip)
+        {
+            const string &block = slot.codec == BlockCodec::NONE ? slot.data : slot.encoded;
+            auto t0 = high_resolution_clock::now();
+            consume(slot.hash, slot.codec, block);
+            consume_time += high_resolution_clock::now() - t0;
+            bytes += slot.data.size();
+            encoded_bytes += block.size();
+            blocks_shrunk += slot.codec != BlockCodec::NONE;
+            ++blocks;
+        }
+
+        advance(slot, FREE);
+        if (last)
+        {
+            break;
+        }
+    }
+
+    reader.join();
+    for (thread &t : hashers)
+    {
+        t.join();
+    }
+    close(fd);
+    run_time += high_resolution_clock::now() - start;
+
+    return !failed;
+}
+
+void BlockPipeline::report()
+{
+    auto log = logger();
+
+    auto secs = [](high_resolution_clock::duration d) { return duration_cast<microseconds>(d).count() / 1e6; };
+    log->error("Pipelined {:.1f} MB in {} blocks of {:.0f} bytes on average", bytes / 1e6, blocks,
+               blocks > 0 ? (double)bytes / blocks : 0.0);
+    log->error("Took {:.3f} seconds: reading busy {:.3f} s, hashing ({} x {}) {:.3f} s, uploading {:.3f} s",
+               secs(run_time), secs(read_time), hash_threads, BlockHasher::name(hasher.engine()),
+               secs(hash_time), secs(consume_time));
+    if (codec.codec() != BlockCodec::NONE)
+    {
+        log->error("Compressed with {}: {:.1f} MB to {:.1f} MB ({:.2f}x), {} of {} blocks shrank, "
+                   "{:.3f} s in total, {:.1f} us of CPU per block",
+                   BlockCodec::name(codec.codec()), bytes / 1e6, encoded_bytes / 1e6,
+                   encoded_bytes > 0 ? (double)bytes / encoded_bytes : 1.0, blocks_shrunk, blocks,
+                   secs(compress_time), blocks > 0 ? secs(compress_time) * 1e6 / blocks : 0.0);
+    }
+}
+
+// read fixed blocksize blocks straight into the ring
+void BlockPipeline::read_stage(int fd)
+{
+    for (size_t seq = 0;; ++seq)
+    {
+        Slot &slot = wait_for(seq, FREE);
+
+        auto t0 = high_resolution_clock::now();
+        slot.data.resize(blocksize); // keeps its capacity, so this rarely allocates
+        size_t filled = 0;
+        bool error = !read_full(fd, &slot.data[0], blocksize, filled);
+        slot.data.resize(filled);
+        read_time += high_resolution_clock::now() - t0;
+
+        if (publish(slot, error || filled < blocksize, error))
+        {
+            return;
+        }
+    }
+}
+
+// read ahead into a staging buffer and copy content-defined chunks out of it
+void BlockPipeline::read_chunks(int fd)
+{
+    // room for a few maximum size chunks between refills
+    string staging(4 * chunker->max_size(), '\0');
+    size_t start = 0, end = 0;
+    bool eof = false, error = false;
+
+    for (size_t seq = 0;; ++seq)
+    {
+        auto t0 = high_resolution_clock::now();
+        // the chunker needs a whole max_size chunk ahead of it, unless the
+        // file ends sooner
+        if (!eof && !error && end - start < chunker->max_size())
+        {
+            memmove(&staging[0], &staging[start], end - start);
+            end -= start;
+            start = 0;
+            size_t filled = 0;
+            error = !read_full(fd, &staging[end], staging.size() - end, filled);
+            eof = filled < staging.size() - end;
+            end += filled;
+        }
+        size_t len = error ? 0 : chunker->cut((const uint8_t *)&staging[start], end - start);
+        read_time += high_resolution_clock::now() - t0;
+
+        Slot &slot = wait_for(seq, FREE);
+        slot.data.assign(&staging[start], len);
+        start += len;
+
+        if (publish(slot, error || (eof && start == end), error))
+        {
+            return;
+        }
+    }
+}
+
+// read until buf holds len bytes or the file ends; false on a read error
+bool BlockPipeline::read_full(int fd, char *buf, size_t len, size_t &filled)
+{
+    auto log = logger();
+
+    while (filled < len)
+    {
+        ssize_t n = read(fd, buf + filled, len - filled);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            log->error("error reading file: {}", strerror(errno));
+            return false;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        filled += n;
+    }
+    return true;
+}
+
+// hand a filled slot to the hashing threads; returns last
+bool BlockPipeline::publish(Slot &slot, bool last, bool error)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        slot.last = last;
+        failed = failed || error;
+    }
+    advance(slot, READ);
+    return last;
+}
+
+void BlockPipeline::hash_stage()
+{
+    for (;;)
+    {
+        // take the next run of blocks that have been read, up to one per lane
+        vector<Slot *> taken;
+        {
+            unique_lock<mutex> guard(lock);
+            changed.wait(guard, [&]() { return hash_finished || ring[hash_next % ring.size()].state == READ; });
+            while (!hash_finished && taken.size() < hasher.lanes() && ring[hash_next % ring.size()].state == READ)
+            {
+                Slot &slot = ring[hash_next++ % ring.size()];
+                slot.state = HASHING;
+                hash_finished = slot.last;
+                taken.push_back(&slot);
+            }
+        }
+        if (taken.empty())
+        {
+            return;
+        }
+
+        auto t0 = high_resolution_clock::now();
+        vector<const string *> blocks;
+        vector<BlockHash *> hashes;
+        for (Slot *slot : taken)
+        {
+            blocks.push_back(&slot->data);
+            hashes.push_back(&slot->hash);
+        }
+        hasher.hash_many(blocks, hashes);
+
+        auto t1 = high_resolution_clock::now();
+        for (Slot *slot : taken)
+        {
+            slot->codec = codec.encode(slot->data, slot->encoded);
+        }
+
+        {
+            lock_guard<mutex> guard(lock);
+            hash_time += t1 - t0;
+            compress_time += high_resolution_clock::now() - t1;
+            for (Slot *slot : taken)
+            {
+                slot->state = HASHED;
+            }
+        }
+        // also wakes the other hashing threads once the last block is taken
+        changed.notify_all();
+    }
+}
+
+// the slot for the seq-th block, once it has reached state
+BlockPipeline::Slot &BlockPipeline::wait_for(size_t seq, SlotState state)
+{
+    Slot &slot = ring[seq % ring.size()];
+    unique_lock<mutex> guard(lock);
+    changed.wait(guard, [&]() { return slot.state == state; });
+    return slot;
+}
+
+void BlockPipeline::advance(Slot &slot, SlotState state)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        slot.state = state;
+    }
+    changed.notify_all();
+}
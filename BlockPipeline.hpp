@@ -0,0 +1,111 @@
+#ifndef BLOCKPIPELINE_HPP
+#define BLOCKPIPELINE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "logger.hpp"
+#include "BlockCodec.hpp"
+#include "BlockHash.hpp"
+#include "BlockHasher.hpp"
+#include "Chunker.hpp"
+
+using namespace std;
+
+/**
+ * Streams a file through three overlapped stages: read the next block, hash
+ * it, and hand it to the caller (the uploader, which places and sends it).
+ *
+ * Blocks move through a fixed ring of ring_blocks reusable buffers. Reading
+ * runs on its own thread and hashing on hash_threads threads, each taking
+ * the next hasher.lanes() blocks that have been read. The caller's stage
+ * runs on the thread that called run(). A stage waits when the next buffer
+ * is not ready for it yet, so at most ring_blocks blocks of the file are in
+ * memory at once, however large the file is.
+ *
+ * Without a chunker, blocks are cut exactly as they always were: blocksize
+ * bytes each, ending with the first short (possibly empty) block. With one,
+ * the read stage reads ahead into a staging buffer and cuts content-defined
+ * chunks out of it, see Chunker.hpp.
+ *
+ * The hashing threads also compress every block they hash with the given
+ * codec, keeping the compressed copy only if it is smaller (see
+ * BlockCodec.hpp), so compression runs on as many cores as hashing does.
+ */
+class BlockPipeline
+{
+  public:
+    // receives each block's hash and the block encoded with codec, in file
+    // order; the block is only valid until consume returns
+    typedef function<void(const BlockHash &hash, BlockCodec::Codec codec, const string &block)> Consumer;
+
+    // chunker may be nullptr for fixed blocksize blocks
+    BlockPipeline(size_t t_blocksize, size_t t_ring_blocks, const BlockHasher &t_hasher, size_t t_hash_threads,
+                  const Chunker *t_chunker, const BlockCodec &t_codec);
+
+    // stream the file at path through consume. Returns false if it could not
+    // be read; blocks before the error may already have been consumed.
+    bool run(const string &path, const Consumer &consume);
+
+    // log how long each stage was busy compared to the time spent in run(),
+    // and how well blocks compressed
+    void report();
+
+  protected:
+    enum SlotState
+    {
+        FREE,    // ready to be filled by the read stage
+        READ,    // holds a block, waiting to be hashed
+        HASHING, // taken by a hashing thread
+        HASHED,  // holds a block and its hash, waiting for the caller
+    };
+
+    struct Slot
+    {
+        string data;
+        BlockHash hash;
+        BlockCodec::Codec codec; // NONE, or how encoded holds data
+        string encoded;
+        SlotState state;
+        bool last; // the final block of the file, or where reading failed
+    };
+
+    size_t blocksize;
+    vector<Slot> ring;
+    const BlockHasher &hasher;
+    size_t hash_threads;
+    const Chunker *chunker;
+    const BlockCodec &codec;
+
+    mutex lock; // guards every slot's state and last, and everything below
+    condition_variable changed;
+    bool failed;
+    size_t hash_next;   // the next block for a hashing thread to take
+    bool hash_finished; // the last block has been taken
+
+    // per stage busy time over every run(), excluding time spent waiting;
+    // hash_time and compress_time add up every hashing thread
+    chrono::high_resolution_clock::duration read_time;
+    chrono::high_resolution_clock::duration hash_time;
+    chrono::high_resolution_clock::duration compress_time;
+    chrono::high_resolution_clock::duration consume_time;
+    chrono::high_resolution_clock::duration run_time;
+    size_t bytes;
+    size_t blocks;
+    size_t encoded_bytes;  // bytes handed to the caller, after compression
+    size_t blocks_shrunk;  // blocks that compressed
+
+    void read_stage(int fd);
+    void read_chunks(int fd);
+    bool read_full(int fd, char *buf, size_t len, size_t &filled);
+    bool publish(Slot &slot, bool last, bool error);
+    void hash_stage();
+    Slot &wait_for(size_t seq, SlotState state);
+    void advance(Slot &slot, SlotState state);
+};
+
+#endif // BLOCKPIPELINE_HPP
@@ -0,0 +1,134 @@
+#ifndef BLOCKSTORE_HPP
+#define BLOCKSTORE_HPP
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "BlockCodec.hpp"
+#include "BlockHash.hpp"
+#include "ShardedMap.hpp"
+
+using namespace std;
+
+/**
+ * A read-only window onto a stored block's bytes, owned by the BlockStore.
+ * Blocks are never deleted or modified once stored, so a view stays valid
+ * for the lifetime of the store, unless the engine may drop the bytes (a
+ * RAM block of the tiered engine): then owner shares them, and the view
+ * stays valid for as long as a copy of owner is kept.
+ */
+struct BlockView
+{
+    const char *data;
+    size_t length;
+    BlockCodec::Codec codec; // how data encodes the block, see BlockCodec.hpp
+    shared_ptr<const string> owner; // empty if the bytes never move
+};
+
+/**
+ * The storage engine behind a SurfStoreServer's block RPCs.
+ *
+ * store_block, get_block and get_all_blocks_hashlist only talk to this
+ * interface, so the server can keep its blocks in memory (the original
+ * behaviour) or on disk without the RPC layer noticing. Every engine must be
+ * safe to call from several RPC worker threads at once.
+ */
+class BlockStore
+{
+  public:
+    virtual ~BlockStore() {}
+
+    // store data, the block encoded with codec, under hash. Blocks are kept
+    // exactly as they were sent. Returns false if the hash is already stored
+    // (we don't handle hash collisions) or if the block could not be written.
+    virtual bool store(const BlockHash &hash, const string &data, BlockCodec::Codec codec) = 0;
+
+    // copy the block stored under hash, still encoded, into data and its
+    // codec into codec. Returns false if absent.
+    virtual bool get(const BlockHash &hash, string &data, BlockCodec::Codec &codec) = 0;
+
+    // point view at the block stored under hash without copying it, so the
+    // RPC layer can serialize straight from storage. Returns false if absent.
+    virtual bool get_view(const BlockHash &hash, BlockView &view) = 0;
+
+    // set bytes to the length of the block stored under hash, as stored,
+    // without reading it or counting it as a read. Returns false if absent.
+    virtual bool length(const BlockHash &hash, uint64_t &bytes)
+    {
+        BlockView view;
+        if (!get_view(hash, view))
+        {
+            return false;
+        }
+        bytes = view.length;
+        return true;
+    }
+
+    virtual bool contains(const BlockHash &hash) = 0;
+
+    // every block hash held by this engine
+    virtual list<BlockHash> hashes() = 0;
+
+    // number of stored blocks
+    virtual size_t size() = 0;
+
+    // counters for sizing the server, by name, see get_block_store_stats
+    virtual map<string, uint64_t> stats()
+    {
+        map<string, uint64_t> out;
+        out["blocks"] = size();
+        return out;
+    }
+};
+
+/**
+ * The original engine: every block is a std::string in memory, lost when
+ * the server restarts.
+ */
+class MemoryBlockStore : public BlockStore
+{
+  public:
+    bool store(const BlockHash &hash, const string &data, BlockCodec::Codec codec)
+    {
+        return hdm.insert(hash, StoredBlock{data, codec});
+    }
+    bool get(const BlockHash &hash, string &data, BlockCodec::Codec &codec)
+    {
+        StoredBlock block;
+        if (!hdm.get(hash, block))
+        {
+            return false;
+        }
+        data.swap(block.data);
+        codec = block.codec;
+        return true;
+    }
+    bool get_view(const BlockHash &hash, BlockView &view)
+    {
+        // hdm is insert-only, so the stored string never moves
+        const StoredBlock *block = hdm.lookup(hash);
+        if (block == nullptr)
+        {
+            return false;
+        }
+        view = BlockView{block->data.data(), block->data.size(), block->codec, nullptr};
+        return true;
+    }
+    bool contains(const BlockHash &hash) { return hdm.contains(hash); }
+    list<BlockHash> hashes() { return hdm.keys(); }
+    size_t size() { return hdm.size(); }
+
+  protected:
+    struct StoredBlock
+    {
+        string data;
+        BlockCodec::Codec codec;
+    };
+
+    ShardedMap<BlockHash, StoredBlock> hdm; // hash: BlockHash -> data_block, as sent
+};
+
+#endif // BLOCKSTORE_HPP
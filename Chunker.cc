@@ -0,0 +1,68 @@
+#include <stdint.h>
+
+#include "Chunker.hpp"
+
+using namespace std;
+
+// the top bits of the Gear hash, which depend on the most bytes
+static uint64_t top_bits(int bits)
+{
+    return bits <= 0 ? 0 : ~0ULL << (64 - bits);
+}
+
+Chunker::Chunker(size_t t_min_size, size_t t_avg_size, size_t t_max_size)
+    : min(t_min_size), max(t_max_size)
+{
+    int bits = 0;
+    while (((size_t)2 << bits) <= t_avg_size)
+    {
+        ++bits;
+    }
+    avg = (size_t)1 << bits;
+
+    // normalization level 2, as recommended by the paper
+    mask_small = top_bits(bits + 2);
+    mask_large = top_bits(bits - 2);
+
+    // splitmix64 from a fixed seed
+    uint64_t x = 0x6765617263646321ULL;
+    for (uint64_t &g : gear)
+    {
+        x += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        g = z ^ (z >> 31);
+    }
+}
+
+size_t Chunker::cut(const uint8_t *data, size_t len) const
+{
+    if (len <= min)
+    {
+        return len;
+    }
+    size_t end = len < max ? len : max;
+    size_t normal = end < avg ? end : avg;
+
+    // skip the first min bytes, no chunk may end there
+    uint64_t fp = 0;
+    size_t i = min;
+    for (; i < normal; ++i)
+    {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & mask_small))
+        {
+            return i + 1;
+        }
+    }
+    for (; i < end; ++i)
+    {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & mask_large))
+        {
+            return i + 1;
+        }
+    }
+    return end;
+}
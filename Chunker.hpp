@@ -0,0 +1,47 @@
+#ifndef CHUNKER_HPP
+#define CHUNKER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+using namespace std;
+
+/**
+ * Content-defined chunking with FastCDC (Xia et al., USENIX ATC '16).
+ *
+ * A Gear rolling hash runs over the data, and a chunk ends where the top
+ * bits of the hash are all zero. The hash only depends on the last 64
+ * bytes, so a cut point depends only on nearby content. An insertion or
+ * deletion therefore moves only the boundaries next to it, and every later
+ * chunk keeps its hash, while with fixed-size blocks every later block
+ * changes.
+ *
+ * Chunks are between min_size and max_size bytes. Normalized chunking uses
+ * a stricter mask before avg_size and a looser one after it, which pulls
+ * chunk sizes towards avg_size. The Gear table comes from a fixed seed, so
+ * every uploader cuts the same data at the same places.
+ */
+class Chunker
+{
+  public:
+    // avg_size is rounded down to a power of two
+    Chunker(size_t t_min_size, size_t t_avg_size, size_t t_max_size);
+
+    // the length of the chunk starting at data. len is how much data is
+    // available; it must be at least max_size() unless the data ends there.
+    size_t cut(const uint8_t *data, size_t len) const;
+
+    size_t min_size() const { return min; }
+    size_t avg_size() const { return avg; }
+    size_t max_size() const { return max; }
+
+  protected:
+    size_t min;
+    size_t avg;
+    size_t max;
+    uint64_t mask_small; // before avg: more bits, so a cut is less likely
+    uint64_t mask_large; // after avg: fewer bits, so a cut is more likely
+    uint64_t gear[256];
+};
+
+#endif // CHUNKER_HPP
@@ -0,0 +1,602 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "logger.hpp"
+#include "SurfStoreTypes.hpp"
+#include "DownloadEngine.hpp"
+#include "Protocol.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+// a server on the same host may answer a ping in a few microseconds
+static const double MIN_RTT_MS = 0.05;
+
+// latencies kept per server for the hedge percentile, and how many are
+// needed before the percentile is trusted over the service time estimate
+static const size_t LATENCY_HISTORY = 64;
+static const size_t MIN_LATENCY_SAMPLES = 8;
+
+DownloadEngine::DownloadEngine(vector<rpc::client *> &t_clients, LatencyTracker &t_latency,
+                               size_t t_batch_blocks, size_t t_window, bool t_stripe,
+                               bool t_hedge, double t_hedge_percentile, int t_protocol, size_t t_decode_threads)
+    : clients(t_clients), latency(t_latency), batch_blocks(t_batch_blocks), window(t_window), stripe(t_stripe),
+      hedge(t_hedge), hedge_percentile(t_hedge_percentile), protocol(t_protocol), recent_latency(t_clients.size()),
+      bytes_fetched(t_clients.size(), 0), busy_time(t_clients.size(), high_resolution_clock::duration::zero()),
+      busy_since(t_clients.size()), requests_sent(0), hedges_sent(0), hedges_won(0), hedge_saved_ms(0),
+      in_flight_count(t_clients.size(), 0), next_request_id(1), fetch_id(0),
+      hashlist(nullptr), holders(nullptr), sink(nullptr), remaining(0), success(true), groups(nullptr), group_need(0),
+      decode_busy(0), decode_failed(false), stopping(false), blocks_decoded(0), bytes_encoded(0), bytes_decoded(0),
+      decode_time(high_resolution_clock::duration::zero())
+{
+    // with window batches of batch_blocks blocks in flight, a server
+    // delivers roughly that many blocks per round trip
+    for (size_t server = 0; server < clients.size(); ++server)
+    {
+        block_ms.push_back(max(latency.srtt_us(server) / 1e3, MIN_RTT_MS) / (batch_blocks * window));
+    }
+
+    // only compressed blocks need decoding, and only protocol version 4 has them
+    for (size_t i = 0; protocol >= 4 && i < t_decode_threads; ++i)
+    {
+        decoders.push_back(thread(&DownloadEngine::decode_stage, this));
+    }
+}
+
+DownloadEngine::~DownloadEngine()
+{
+    {
+        lock_guard<mutex> guard(decode_lock);
+        stopping = true;
+    }
+    decode_ready.notify_all();
+    for (thread &t : decoders)
+    {
+        t.join();
+    }
+}
+
+bool DownloadEngine::fetch(const vector<BlockHash> &t_hashlist, const vector<vector<int>> &t_holders, const Sink &t_sink,
+                           const vector<int> &t_groups, size_t t_group_need)
+{
+    auto log = logger();
+
+    ++fetch_id;
+    hashlist = &t_hashlist;
+    holders = &t_holders;
+    sink = &t_sink;
+    groups = &t_groups;
+    group_need = t_group_need;
+    done.assign(hashlist->size(), false);
+    holder_pos.assign(hashlist->size(), 0);
+    attempts.assign(hashlist->size(), 0);
+    outstanding.assign(hashlist->size(), 0);
+    queue.assign(clients.size(), deque<size_t>());
+    remaining = 0;
+    success = true;
+
+    group_blocks.clear();
+    for (size_t block_idx = 0; block_idx < hashlist->size(); ++block_idx)
+    {
+        int group = group_of(block_idx);
+        if (group >= 0)
+        {
+            group_blocks.resize(max(group_blocks.size(), (size_t)group + 1));
+            group_blocks[group].push_back(block_idx);
+        }
+    }
+    group_arrived.assign(group_blocks.size(), 0);
+    group_wanted.assign(group_blocks.size(), group_need);
+    group_lost.assign(group_blocks.size(), 0);
+    dropped.assign(hashlist->size(), false);
+
+    // spread the blocks over their holders
+    vector<double> load(clients.size(), 0.0);
+    for (size_t block_idx = 0; block_idx < hashlist->size(); ++block_idx)
+    {
+        if ((*holders)[block_idx].empty())
+        {
+            if (group_of(block_idx) < 0)
+            {
+                log->error("Block with hash {} is not stored on any server. Skip.", (*hashlist)[block_idx].hex());
+            }
+            give_up(block_idx);
+            continue;
+        }
+        assign(block_idx, load);
+        ++remaining;
+    }
+
+    while (remaining > 0)
+    {
+        for (size_t server = 0; server < clients.size(); ++server)
+        {
+            issue(server);
+        }
+
+        // handle replies in whatever order they arrive, and hedge the
+        // requests that are taking too long
+        bool any_ready = false;
+        for (auto it = in_flight.begin(); it != in_flight.end();)
+        {
+            if (it->reply.wait_for(seconds(0)) == future_status::ready)
+            {
+                complete(*it);
+                it = in_flight.erase(it);
+                any_ready = true;
+                continue;
+            }
+            if (hedge && !it->hedged && it->fetch_id == fetch_id)
+            {
+                maybe_hedge(*it);
+            }
+            ++it;
+        }
+        if (!any_ready && !in_flight.empty())
+        {
+            in_flight.front().reply.wait_for(milliseconds(1));
+        }
+    }
+
+    wait_decoded();
+    return success;
+}
+
+void DownloadEngine::report()
+{
+    auto log = logger();
+
+    for (size_t server = 0; server < clients.size(); ++server)
+    {
+        double secs = duration_cast<microseconds>(busy_time[server]).count() / 1e6;
+        double mb = bytes_fetched[server] / 1e6;
+        log->error("Downloaded {:.1f} MB from server #{} in {:.3f} seconds: {:.2f} MB/s",
+                   mb, server, secs, secs > 0 ? mb / secs : 0.0);
+    }
+
+    if (hedge)
+    {
+        log->error("Hedged {} of {} get_blocks requests ({:.1f}%); {} hedges won, saving {:.0f} milliseconds",
+                   hedges_sent, requests_sent, requests_sent > 0 ? 100.0 * hedges_sent / requests_sent : 0.0,
+                   hedges_won, hedge_saved_ms);
+    }
+
+    lock_guard<mutex> guard(decode_lock);
+    if (blocks_decoded > 0)
+    {
+        double secs = duration_cast<microseconds>(decode_time).count() / 1e6;
+        log->error("Decompressed {} blocks on {} threads: {:.1f} MB to {:.1f} MB ({:.2f}x), {:.3f} s in total, "
+                   "{:.1f} us of CPU per block",
+                   blocks_decoded, decoders.size(), bytes_encoded / 1e6, bytes_decoded / 1e6,
+                   bytes_encoded > 0 ? (double)bytes_decoded / bytes_encoded : 1.0, secs, secs * 1e6 / blocks_decoded);
+    }
+}
+
+/**
+ * Give a block to whichever of its holders would finish it first, counting
+ * the blocks that holder has already been given for this file. Without
+ * striping that is always the closest holder.
+ */
+void DownloadEngine::assign(size_t block_idx, vector<double> &load)
+{
+    const vector<int> &candidates = (*holders)[block_idx];
+
+    size_t best = 0;
+    double best_finish = (load[candidates[0]] + 1) * block_ms[candidates[0]];
+    for (size_t pos = 1; stripe && pos < candidates.size(); ++pos)
+    {
+        int server = candidates[pos];
+        double finish = (load[server] + 1) * block_ms[server];
+        if (finish < best_finish)
+        {
+            best = pos;
+            best_finish = finish;
+        }
+    }
+
+    holder_pos[block_idx] = best;
+    load[candidates[best]] += 1;
+    queue[candidates[best]].push_back(block_idx);
+}
+
+/**
+ * Fill server's window with get_blocks calls from its queue.
+ */
+void DownloadEngine::issue(int server)
+{
+    while (in_flight_count[server] < window && !queue[server].empty())
+    {
+        vector<size_t> block_idxs;
+        while (block_idxs.size() < batch_blocks && !queue[server].empty())
+        {
+            if (!done[queue[server].front()])
+            {
+                block_idxs.push_back(queue[server].front());
+            }
+            queue[server].pop_front();
+        }
+        if (!block_idxs.empty())
+        {
+            send(server, block_idxs, 0);
+        }
+    }
+}
+
+void DownloadEngine::send(int server, const vector<size_t> &block_idxs, size_t hedge_of)
+{
+    Request req;
+    req.id = next_request_id++;
+    req.fetch_id = fetch_id;
+    req.server = server;
+    req.block_idxs = block_idxs;
+    req.hedged = hedge_of != 0; // hedges are not hedged again
+    req.hedge_of = hedge_of;
+
+    vector<string> batch_hashes;
+    for (size_t block_idx : block_idxs)
+    {
+        batch_hashes.push_back((*hashlist)[block_idx].raw());
+        ++outstanding[block_idx];
+    }
+
+    if (in_flight_count[server] == 0)
+    {
+        busy_since[server] = high_resolution_clock::now();
+    }
+    req.concurrency = ++in_flight_count[server];
+    req.sent = high_resolution_clock::now();
+    req.reply = clients[server]->async_call(protocol >= 4 ? "get_encoded_blocks" : "get_blocks", batch_hashes);
+    in_flight.push_back(move(req));
+
+    if (hedge_of == 0)
+    {
+        ++requests_sent;
+    }
+}
+
+void DownloadEngine::complete(Request &req)
+{
+    auto log = logger();
+    int server = req.server;
+    auto now = high_resolution_clock::now();
+
+    if (--in_flight_count[server] == 0)
+    {
+        busy_time[server] += now - busy_since[server];
+    }
+
+    vector<string> data;
+    string codecs; // one BlockCodec::Codec per block; all NONE before protocol version 4
+    bool ok = true;
+    try
+    {
+        if (protocol >= 4)
+        {
+            auto reply = req.reply.get().as<pair<string, vector<string>>>();
+            codecs.swap(reply.first);
+            data.swap(reply.second);
+        }
+        else
+        {
+            data = req.reply.get().as<vector<string>>();
+        }
+    }
+    catch (exception &e)
+    {
+        log->error("get_blocks from server #{} failed: {}", server, e.what());
+        ok = false;
+    }
+
+    size_t bytes = 0;
+    for (const string &block : data)
+    {
+        bytes += block.size();
+    }
+    bytes_fetched[server] += bytes;
+
+    // refine this server's latency statistics
+    if (ok)
+    {
+        double us = duration_cast<nanoseconds>(now - req.sent).count() / 1e3;
+        double ms = us / 1e3;
+        double sample = ms / (req.block_idxs.size() * req.concurrency);
+        block_ms[server] = 0.75 * block_ms[server] + 0.25 * sample;
+
+        recent_latency[server].push_back(ms);
+        if (recent_latency[server].size() > LATENCY_HISTORY)
+        {
+            recent_latency[server].pop_front();
+        }
+    }
+
+    // this request lost the race against its hedge: the time between the
+    // two replies is latency the hedge saved
+    auto won = hedge_won_at.find(req.id);
+    if (won != hedge_won_at.end())
+    {
+        hedge_saved_ms += duration_cast<microseconds>(now - won->second).count() / 1e3;
+        hedge_won_at.erase(won);
+    }
+
+    // a straggler from an earlier fetch(); its blocks were delivered by a hedge
+    if (req.fetch_id != fetch_id)
+    {
+        return;
+    }
+
+    size_t arrived = 0;
+    for (size_t k = 0; k < req.block_idxs.size(); ++k)
+    {
+        size_t block_idx = req.block_idxs[k];
+        --outstanding[block_idx];
+        if (done[block_idx])
+        {
+            continue;
+        }
+        // An empty reply for anything but the empty block means the server
+        // does not hold it after all (a digest false positive): treat it
+        // like a failed fetch and move on to the next holder.
+        bool missing = k < data.size() && data[k].empty() && (*hashlist)[block_idx] != EMPTY_BLOCK_HASH;
+        BlockCodec::Codec codec = k < codecs.size() && BlockCodec::valid((uint8_t)codecs[k])
+                                      ? (BlockCodec::Codec)codecs[k] : BlockCodec::NONE;
+        if (k < data.size() && !missing)
+        {
+            if (codec == BlockCodec::NONE)
+            {
+                (*sink)(block_idx, data[k]);
+            }
+            else
+            {
+                {
+                    lock_guard<mutex> guard(decode_lock);
+                    decode_queue.push_back(DecodeJob{block_idx, codec, string()});
+                    decode_queue.back().data.swap(data[k]);
+                }
+                decode_ready.notify_one();
+            }
+            delivered(block_idx);
+            ++arrived;
+        }
+        else if (outstanding[block_idx] == 0)
+        {
+            retry(block_idx);
+        }
+    }
+
+    if (req.hedge_of != 0 && arrived > 0)
+    {
+        ++hedges_won;
+        hedge_won_at[req.hedge_of] = now;
+    }
+}
+
+/**
+ * Move a block whose fetch failed on to its next holder, if it has one left.
+ */
+void DownloadEngine::retry(size_t block_idx)
+{
+    auto log = logger();
+    const vector<int> &candidates = (*holders)[block_idx];
+
+    if (++attempts[block_idx] >= candidates.size())
+    {
+        if (group_of(block_idx) < 0)
+        {
+            log->error("Block with hash {} could not be fetched from any server. Skip.", (*hashlist)[block_idx].hex());
+        }
+        --remaining;
+        give_up(block_idx);
+        return;
+    }
+    queue[candidates[(holder_pos[block_idx] + attempts[block_idx]) % candidates.size()]].push_back(block_idx);
+}
+
+// the group of a block, or -1 if it is in none
+int DownloadEngine::group_of(size_t block_idx)
+{
+    return block_idx < groups->size() ? (*groups)[block_idx] : -1;
+}
+
+/**
+ * A block has arrived. Once its group has enough, the rest of the group is
+ * done as well; their requests still in flight are ignored when they return.
+ */
+void DownloadEngine::delivered(size_t block_idx)
+{
+    done[block_idx] = true;
+    --remaining;
+
+    int group = group_of(block_idx);
+    if (group < 0 || ++group_arrived[group] != group_wanted[group])
+    {
+        return;
+    }
+    for (size_t other : group_blocks[group])
+    {
+        if (!done[other])
+        {
+            done[other] = true;
+            dropped[other] = true;
+            --remaining;
+        }
+    }
+}
+
+/**
+ * Take back the blocks of block_idx's group that were dropped when it had
+ * enough, and wait for one more of them. A block whose request is still in
+ * flight is taken from its reply; the others are requested again.
+ */
+void DownloadEngine::need_another(size_t block_idx)
+{
+    auto log = logger();
+
+    int group = group_of(block_idx);
+    if (group < 0)
+    {
+        return;
+    }
+    if (group_blocks[group].size() - group_lost[group] < ++group_wanted[group])
+    {
+        log->error("Only {} of the {} blocks of group {} can be fetched, {} are needed",
+                   group_blocks[group].size() - group_lost[group], group_blocks[group].size(), group, group_wanted[group]);
+        success = false;
+        return;
+    }
+    for (size_t other : group_blocks[group])
+    {
+        if (!dropped[other])
+        {
+            continue;
+        }
+        dropped[other] = false;
+        done[other] = false;
+        ++remaining;
+        if (outstanding[other] == 0)
+        {
+            const vector<int> &candidates = (*holders)[other];
+            queue[candidates[(holder_pos[other] + attempts[other]) % candidates.size()]].push_back(other);
+        }
+    }
+}
+
+/**
+ * A block could not be fetched. That fails the fetch, unless the block is in
+ * a group that can still get enough of its other blocks.
+ */
+void DownloadEngine::give_up(size_t block_idx)
+{
+    auto log = logger();
+
+    done[block_idx] = true;
+    int group = group_of(block_idx);
+    if (group < 0)
+    {
+        success = false;
+        return;
+    }
+    if (group_blocks[group].size() - ++group_lost[group] + 1 == group_wanted[group])
+    {
+        log->error("Only {} of the {} blocks of group {} can be fetched, {} are needed",
+                   group_blocks[group].size() - group_lost[group], group_blocks[group].size(), group, group_wanted[group]);
+        success = false;
+    }
+}
+
+/**
+ * Once req has been outstanding for longer than its hedge delay, request
+ * its unfinished blocks again from the closest other holder of each.
+ */
+void DownloadEngine::maybe_hedge(Request &req)
+{
+    double elapsed = duration_cast<microseconds>(high_resolution_clock::now() - req.sent).count() / 1e3;
+    if (elapsed < hedge_delay_ms(req))
+    {
+        return;
+    }
+    req.hedged = true;
+
+    map<int, vector<size_t>> by_server;
+    for (size_t block_idx : req.block_idxs)
+    {
+        if (done[block_idx])
+        {
+            continue;
+        }
+        for (int server : (*holders)[block_idx])
+        {
+            if (server != req.server)
+            {
+                by_server[server].push_back(block_idx);
+                break;
+            }
+        }
+    }
+
+    for (auto const &target : by_server)
+    {
+        send(target.first, target.second, req.id);
+        ++hedges_sent;
+    }
+}
+
+/**
+ * How long to wait for req before hedging it: the hedge_percentile of its
+ * server's recent get_blocks latencies. Until enough of those have been
+ * seen, three times the latency the service time estimate predicts.
+ */
+double DownloadEngine::hedge_delay_ms(const Request &req)
+{
+    const deque<double> &history = recent_latency[req.server];
+    if (history.size() < MIN_LATENCY_SAMPLES)
+    {
+        return 3 * block_ms[req.server] * req.block_idxs.size() * req.concurrency;
+    }
+
+    vector<double> sorted(history.begin(), history.end());
+    sort(sorted.begin(), sorted.end());
+    size_t rank = min(sorted.size() - 1, (size_t)(sorted.size() * hedge_percentile / 100));
+    return sorted[rank];
+}
+
+// a decode thread: decompress queued blocks and pass them on until stopping
+void DownloadEngine::decode_stage()
+{
+    auto log = logger();
+
+    for (;;)
+    {
+        DecodeJob job;
+        {
+            unique_lock<mutex> guard(decode_lock);
+            decode_ready.wait(guard, [&]() { return stopping || !decode_queue.empty(); });
+            if (decode_queue.empty())
+            {
+                return;
+            }
+            job = move(decode_queue.front());
+            decode_queue.pop_front();
+            ++decode_busy;
+        }
+
+        // fetch() waits for every job before it lets go of sink
+        string block;
+        auto t0 = high_resolution_clock::now();
+        bool ok = BlockCodec::decode(job.codec, job.data.data(), job.data.size(), block);
+        auto elapsed = high_resolution_clock::now() - t0;
+        if (ok)
+        {
+            (*sink)(job.block_idx, block);
+        }
+        else
+        {
+            log->error("Block with hash {} does not decompress with {}. Skip.",
+                       (*hashlist)[job.block_idx].hex(), BlockCodec::name(job.codec));
+            block.clear();
+        }
+
+        {
+            lock_guard<mutex> guard(decode_lock);
+            --decode_busy;
+            decode_failed = decode_failed || !ok;
+            ++blocks_decoded;
+            bytes_encoded += job.data.size();
+            bytes_decoded += block.size();
+            decode_time += elapsed;
+        }
+        decode_idle.notify_all();
+    }
+}
+
+// wait until every compressed block of this fetch() is decoded
+void DownloadEngine::wait_decoded()
+{
+    unique_lock<mutex> guard(decode_lock);
+    decode_idle.wait(guard, [&]() { return decode_queue.empty() && decode_busy == 0; });
+    if (decode_failed)
+    {
+        success = false;
+        decode_failed = false;
+    }
+}
@@ -0,0 +1,198 @@
+#ifndef DOWNLOADENGINE_HPP
+#define DOWNLOADENGINE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rpc/client.h"
+
+#include "logger.hpp"
+#include "BlockCodec.hpp"
+#include "BlockHash.hpp"
+#include "LatencyTracker.hpp"
+
+using namespace std;
+
+/**
+ * Fetches the blocks of a file from the SurfStoreServers in parallel.
+ *
+ * Every block comes with the list of servers holding a replica of it,
+ * closest first. Without striping every block is fetched from its closest
+ * holder. With striping, blocks are spread over their holders so that they
+ * all finish at about the same time: each server has an estimated service
+ * time per block, seeded from its smoothed RTT and refined from the latency
+ * of every get_blocks reply, and a block goes to the holder that would
+ * finish it earliest given what that server is already assigned.
+ *
+ * Each server's share is fetched with get_blocks calls of batch_blocks
+ * blocks, up to window of them in flight per server at once. A block whose
+ * fetch fails, because the RPC failed or the server turned out not to hold
+ * it, is retried on its next holder.
+ *
+ * With hedging on, a batch that has been outstanding for longer than the
+ * hedge_percentile latency of its server is also requested from the
+ * next-closest holder of each of its blocks, and whichever reply arrives
+ * first is used. The slower reply is dropped when it shows up, even if that
+ * is during a later fetch().
+ *
+ * With protocol version 4, blocks are fetched with get_encoded_blocks and
+ * arrive as the servers stored them, possibly compressed. Compressed blocks
+ * are handed to a pool of decode_threads threads, so decompression overlaps
+ * with the fetches still in flight; fetch() returns once every block of the
+ * file has been decompressed.
+ *
+ * get_blocks replies are not passed on to the LatencyTracker: their time
+ * grows with the blocks they carry, and would rank servers by payload
+ * rather than distance. Its background pings keep the ranking current.
+ *
+ * Blocks may be put in groups, of which any group_need blocks will do, as
+ * for the fragments of an erasure-coded block: all of a group's blocks are
+ * requested at once, and once group_need of them have arrived the others
+ * are dropped, so the slowest holders are never waited for. If the sink
+ * finds that the blocks it got will not do (a fragment is corrupt), it calls
+ * need_another() and the group waits for one more. A group only fails once
+ * too many of its blocks have.
+ *
+ * Blocks are handed to a Sink as they arrive, in no particular order, and
+ * are not kept afterwards, so a file is never held in memory as a whole.
+ */
+class DownloadEngine
+{
+  public:
+    // receives block block_idx of the file once it has arrived and been
+    // decompressed; called once per block, possibly from several threads at
+    // once, and the block is only valid until it returns
+    typedef function<void(size_t block_idx, const string &block)> Sink;
+
+    DownloadEngine(vector<rpc::client *> &t_clients, LatencyTracker &t_latency,
+                   size_t t_batch_blocks, size_t t_window, bool t_stripe,
+                   bool t_hedge, double t_hedge_percentile, int t_protocol, size_t t_decode_threads);
+    ~DownloadEngine();
+
+    // fetch the block for hashlist[i] from one of holders[i] and pass it to
+    // sink. Returns false if some block could not be fetched from any of its
+    // holders; sink never sees that block. If groups is not empty, blocks i
+    // with groups[i] >= 0 are in group groups[i], and only group_need blocks
+    // of each group are needed.
+    bool fetch(const vector<BlockHash> &hashlist, const vector<vector<int>> &holders, const Sink &sink,
+               const vector<int> &groups = vector<int>(), size_t group_need = 0);
+
+    // from sink, for an uncompressed block_idx in a group: the blocks of
+    // its group delivered so far will not do, fetch one more of them
+    void need_another(size_t block_idx);
+
+    // log the bytes fetched from, and the achieved MB/s of, every server,
+    // how much hedging issued and saved, and what decompression cost
+    void report();
+
+  protected:
+    struct Request
+    {
+        size_t id;
+        size_t fetch_id; // which fetch() this request belongs to
+        int server;
+        vector<size_t> block_idxs;
+        future<RPCLIB_MSGPACK::object_handle> reply;
+        chrono::high_resolution_clock::time_point sent;
+        size_t concurrency; // requests in flight to this server when sent, including this one
+        bool hedged;        // a hedge has been issued for this request
+        size_t hedge_of;    // id of the request this one hedges, or 0
+    };
+
+    // a compressed block waiting for a decode thread
+    struct DecodeJob
+    {
+        size_t block_idx;
+        BlockCodec::Codec codec;
+        string data;
+    };
+
+    vector<rpc::client *> &clients;
+    LatencyTracker &latency;
+    size_t batch_blocks; // blocks per get_blocks call
+    size_t window;       // get_blocks calls outstanding per server
+    bool stripe;
+    bool hedge;
+    double hedge_percentile;
+    int protocol; // negotiated with the servers, see Protocol.hpp
+
+    vector<double> block_ms;              // estimated milliseconds per block, per server
+    vector<deque<double>> recent_latency; // latest get_blocks latencies (ms), per server
+
+    // per server throughput accounting, see UploadEngine
+    vector<size_t> bytes_fetched;
+    vector<chrono::high_resolution_clock::duration> busy_time;
+    vector<chrono::high_resolution_clock::time_point> busy_since;
+
+    // hedging accounting
+    size_t requests_sent;
+    size_t hedges_sent;
+    size_t hedges_won;
+    double hedge_saved_ms;
+    map<size_t, chrono::high_resolution_clock::time_point> hedge_won_at; // original request id -> when its hedge delivered
+
+    // requests of this and earlier fetch() calls whose replies are pending
+    list<Request> in_flight;
+    vector<size_t> in_flight_count;
+    size_t next_request_id;
+    size_t fetch_id;
+
+    // state of the fetch() in progress
+    const vector<BlockHash> *hashlist;
+    const vector<vector<int>> *holders;
+    const Sink *sink;
+    vector<bool> done;           // per block: fetched or given up on
+    vector<size_t> holder_pos;   // per block: which of its holders it is assigned to
+    vector<size_t> attempts;     // per block: failed fetches so far
+    vector<size_t> outstanding;  // per block: requests in flight that include it
+    vector<deque<size_t>> queue; // per server: block indices not requested yet
+    size_t remaining;
+    bool success;
+
+    // groups of the fetch() in progress
+    const vector<int> *groups;
+    size_t group_need;
+    vector<vector<size_t>> group_blocks; // per group: its block indices
+    vector<size_t> group_arrived;        // per group: blocks delivered
+    vector<size_t> group_wanted;         // per group: group_need, plus one per need_another()
+    vector<bool> dropped;                // per block: done only because its group had enough
+    vector<size_t> group_lost;           // per group: blocks given up on
+
+    // the decode thread pool; everything below is guarded by decode_lock
+    vector<thread> decoders;
+    mutex decode_lock;
+    condition_variable decode_ready; // a job was queued, or stopping
+    condition_variable decode_idle;  // a job finished
+    deque<DecodeJob> decode_queue;
+    size_t decode_busy; // jobs taken but not finished
+    bool decode_failed; // some block of this fetch() did not decompress
+    bool stopping;
+    size_t blocks_decoded;
+    size_t bytes_encoded; // compressed bytes decoded, and what they decoded to
+    size_t bytes_decoded;
+    chrono::high_resolution_clock::duration decode_time; // adds up every decode thread
+
+    void assign(size_t block_idx, vector<double> &load);
+    void issue(int server);
+    void send(int server, const vector<size_t> &block_idxs, size_t hedge_of);
+    void complete(Request &req);
+    void retry(size_t block_idx);
+    int group_of(size_t block_idx);
+    void delivered(size_t block_idx);
+    void give_up(size_t block_idx);
+    void maybe_hedge(Request &req);
+    double hedge_delay_ms(const Request &req);
+    void decode_stage();
+    void wait_decoded();
+};
+
+#endif // DOWNLOADENGINE_HPP
@@ -9,63 +9,246 @@
 #include <algorithm>
 #include <time.h>
 #include <math.h>
+#include <stdio.h>
+#include <fstream>
+#include <memory>
+#include <dirent.h>
+#include <sstream>
+#include <thread>
+#include <mutex>
 #include "rpc/server.h"
 #include "rpc/rpc_error.h"
 #include "picosha2/picosha2.h"
 
 #include "logger.hpp"
 #include "Downloader.hpp"
+#include "DownloadEngine.hpp"
+#include "FileAssembler.hpp"
+#include "BlockCache.hpp"
+#include "BlockPipeline.hpp"
+#include "Chunker.hpp"
+#include "BlockDigest.hpp"
+#include "Protocol.hpp"
+#include "LatencyTracker.hpp"
+#include "ErasureCode.hpp"
+#include "PlacementPolicy.hpp"
 
 using namespace std;
 using namespace std::chrono;
 
-float getstd(vector<int>& vec){
-    float var = 0;
-    float mean = accumulate(vec.begin(), vec.end(), 0.0)/vec.size(); 
-    
-    for(const auto& item : vec)
+/**
+ * Hash the files already in base_dir, cutting them into blocks the way the
+ * uploader would, and tell cache where each block is. A file about to be
+ * downloaded again often has most of its blocks in its old copy.
+ */
+void Downloader::index_local_files(BlockCache &cache, const BlockHasher &hasher)
+{
+    auto log = logger();
+
+    unique_ptr<Chunker> chunker;
+    if (chunking == "cdc")
+    {
+        chunker.reset(new Chunker(cdc_min_size, cdc_avg_size, cdc_max_size));
+    }
+    size_t hash_threads = max(1u, thread::hardware_concurrency());
+    size_t ring_blocks = max((size_t)8, 2 * hash_threads * hasher.lanes());
+    BlockCodec codec(BlockCodec::NONE, 0);
+    BlockPipeline pipeline(blocksize, ring_blocks, hasher, hash_threads, chunker.get(), codec);
+
+    size_t files = 0;
+    DIR *dirp = opendir(base_dir.c_str());
+    struct dirent *dp;
+    while (dirp != NULL && (dp = readdir(dirp)) != NULL)
     {
-      var += (item - mean) * (item - mean);
+        string filename = dp->d_name;
+
+        // skip any file starting with ., like the uploader
+        if (filename[0] == '.') { continue; }
+
+        string path = base_dir + "/" + filename;
+        uint64_t offset = 0;
+        pipeline.run(path, [&](const BlockHash &hash, BlockCodec::Codec, const string &block) {
+            cache.add_local(hash, path, offset, block.size());
+            offset += block.size();
+        });
+        ++files;
     }
-    var /= vec.size();
-    return sqrt(var);
+    if (dirp != NULL)
+    {
+        closedir(dirp);
+    }
+    log->info("Indexed the blocks of {} local files", files);
 }
 
-float __calcSingleRTT(rpc::client *client, int index)
+/**
+ * Read the inventories saved by an earlier run. Each record starts with a
+ * text line "host:port epoch next_seq bytes" followed by that many bytes of
+ * packed fingerprints. Records for servers no longer in the config are
+ * ignored; servers without a record start from scratch.
+ */
+void Downloader::load_inventory(vector<ServerInventory> &inventories)
 {
     auto log = logger();
-    vector<int> durations;
-    log->info("Calculating RTT for server #{}...", index);
-    // compute, for every datacenter, the average of eight round-trip time measurements.
-    for (int j = 0; j < 8; j++)
+
+    for (ServerInventory &inv : inventories)
     {
-        auto start = high_resolution_clock::now();
-        client->call("ping"); // time the latency of a ping() RPC call for RTT
-        auto stop = high_resolution_clock::now();
-        auto duration = duration_cast<milliseconds>(stop - start).count();
-        durations.push_back(duration);
-        log->error("RTT #{} = {}", j, duration);
+        inv.epoch = 0;
+        inv.next_seq = 0;
     }
-    float average = accumulate(durations.begin(), durations.end(), 0.0 ) / durations.size();
-    log->error("Average RTT is {} for server #{}...", average, index);
-    log->info("RTT standard dev: {} milliseconds for server #{}", getstd(durations), index);
 
-    return average;
+    ifstream in(inventory_file, ifstream::binary);
+    string header;
+    while (getline(in, header))
+    {
+        string addr;
+        uint64_t epoch = 0, next_seq = 0;
+        size_t bytes = 0;
+        istringstream fields(header);
+        fields >> addr >> epoch >> next_seq >> bytes;
+
+        string packed(bytes, '\0');
+        if (!fields || !in.read(&packed[0], bytes))
+        {
+            log->error("Inventory file {} is corrupt, ignoring the rest of it", inventory_file);
+            break;
+        }
+
+        for (int i = 0; i < num_servers; ++i)
+        {
+            if (addr == ssdhosts[i] + ":" + std::to_string(ssdports[i]))
+            {
+                inventories[i].epoch = epoch;
+                inventories[i].next_seq = next_seq;
+                inventories[i].digest.load(packed);
+            }
+        }
+    }
 }
 
-void Downloader::create_file_from_blocklist(string filename, list<string> &blocks)
+void Downloader::save_inventory(vector<ServerInventory> &inventories)
 {
     auto log = logger();
-    log->info("Reconstituting file '{}'", filename);
-    std::ofstream out(base_dir + "/" + filename);
 
-    for (const string &block : blocks)
+    // write a temporary file and rename it over the old one, so a crash
+    // never leaves a half-written inventory behind
+    string tmp = inventory_file + ".tmp";
     {
-        out << block;
+        ofstream out(tmp, ofstream::binary | ofstream::trunc);
+        for (int i = 0; i < num_servers; ++i)
+        {
+            string packed = inventories[i].digest.serialize();
+            out << ssdhosts[i] << ":" << ssdports[i] << " " << inventories[i].epoch << " "
+                << inventories[i].next_seq << " " << packed.size() << "\n";
+            out.write(packed.data(), packed.size());
+        }
+        if (!out)
+        {
+            log->error("Unable to write inventory file {}", tmp);
+            return;
+        }
     }
 
-    out.close();
-    log->info("File '{}' reconstitution successful", filename);
+    if (rename(tmp.c_str(), inventory_file.c_str()) != 0)
+    {
+        log->error("Unable to replace inventory file {}", inventory_file);
+    }
+}
+
+/**
+ * Rebuild the block of rebuild from data() of its fragments, trying every
+ * choice of them that includes fragment newest (the others have been tried),
+ * and keep the first that matches the block's hash. Fragments are keyed by
+ * fragment_hash(), not by their contents, so only this catches a stale or
+ * corrupt one.
+ */
+bool Downloader::rebuild_block(const ErasureCode &code, const BlockHasher &hasher, const Rebuild &rebuild, int newest,
+                               string &block)
+{
+    vector<int> others; // fragments that arrived before newest
+    for (int index = 0; index < code.fragments(); ++index)
+    {
+        if (index != newest && !rebuild.fragments[index].empty())
+        {
+            others.push_back(index);
+        }
+    }
+    size_t choose = code.data() - 1;
+    if (others.size() < choose)
+    {
+        return false;
+    }
+
+    // every choose of others, in turn
+    vector<bool> pick(others.size(), false);
+    fill(pick.begin(), pick.begin() + choose, true);
+    do
+    {
+        vector<const string *> in(code.fragments(), nullptr);
+        in[newest] = &rebuild.fragments[newest];
+        for (size_t k = 0; k < others.size(); ++k)
+        {
+            if (pick[k])
+            {
+                in[others[k]] = &rebuild.fragments[others[k]];
+            }
+        }
+        string encoded, decoded;
+        BlockCodec::Codec codec;
+        if (!code.decode(in, encoded, codec))
+        {
+            continue;
+        }
+        if (codec == BlockCodec::NONE)
+        {
+            decoded.swap(encoded);
+        }
+        else if (!BlockCodec::decode(codec, encoded.data(), encoded.size(), decoded))
+        {
+            continue;
+        }
+        BlockHash hash;
+        hasher.hash(decoded, hash);
+        if (hash == rebuild.hash)
+        {
+            block.swap(decoded);
+            return true;
+        }
+    } while (prev_permutation(pick.begin(), pick.end()));
+    return false;
+}
+
+/**
+ * The servers that may hold hash. With rendezvous, the ones it places the
+ * block on, in the order of indices, then every other server in its rank,
+ * where the block was placed before servers were added; otherwise the ones
+ * whose digests may hold it, in the order of indices.
+ */
+vector<int> Downloader::find_holders(vector<ServerInventory> &inventories, const RendezvousPolicy *rendezvous,
+                                     const vector<int> &indices, const BlockHash &hash)
+{
+    vector<int> found;
+    if (rendezvous != nullptr)
+    {
+        vector<int> order = rendezvous->rank(hash);
+        vector<int> placed(order.begin(), order.begin() + min((size_t)replicas, order.size()));
+        for (int server : indices)
+        {
+            if (find(placed.begin(), placed.end(), server) != placed.end())
+            {
+                found.push_back(server);
+            }
+        }
+        found.insert(found.end(), order.begin() + placed.size(), order.end());
+        return found;
+    }
+
+    // iterate through all available servers from closest to farthest
+    for (size_t find_serv_idx = 0; find_serv_idx < indices.size(); ++find_serv_idx) {
+        if (inventories[indices[find_serv_idx]].digest.may_contain(hash)) {
+            found.push_back(indices[find_serv_idx]);
+        } // end if
+    } // end finding servers for current block
+    return found;
 }
 
 Downloader::Downloader(INIReader &t_config)
@@ -91,6 +274,131 @@ Downloader::Downloader(INIReader &t_config)
     }
     log->info("Using a block size of {}", blocksize);
 
+    // Read in the per-RPC batch budget; by default a batch holds 8 blocks
+    batch_bytes = (int)config.GetInteger("downloader", "batch_bytes", 8 * (long)blocksize);
+    if (batch_bytes <= 0)
+    {
+        log->error("Invalid batch size: {}", batch_bytes);
+        exit(EX_CONFIG);
+    }
+    log->info("Using a batch size of {} bytes", batch_bytes);
+
+    // Read in the parallel download mode settings
+    parallel = config.GetBoolean("downloader", "parallel", false);
+    window = (int)config.GetInteger("downloader", "window", 4);
+    if (window <= 0)
+    {
+        log->error("Invalid in-flight window: {}", window);
+        exit(EX_CONFIG);
+    }
+    if (parallel)
+    {
+        log->info("Striping downloads over all replicas, {} batches in flight per server", window);
+    }
+
+    // Read in the hedged read settings
+    hedge = config.GetBoolean("downloader", "hedge", false);
+    hedge_percentile = config.GetReal("downloader", "hedge_percentile", 95);
+    if (hedge_percentile <= 0 || hedge_percentile >= 100)
+    {
+        log->error("Invalid hedge percentile: {}", hedge_percentile);
+        exit(EX_CONFIG);
+    }
+    if (hedge)
+    {
+        log->info("Hedging requests slower than the p{} latency", hedge_percentile);
+    }
+
+    // Read in how the files were cut into blocks, which decides where each
+    // block goes; the same as the uploader unless set here
+    chunking = config.Get("downloader", "chunking", config.Get("uploader", "chunking", "fixed"));
+    if (chunking != "fixed" && chunking != "cdc")
+    {
+        log->error("Invalid chunking: {}", chunking);
+        exit(EX_CONFIG);
+    }
+
+    // Read in how many threads decompress blocks
+    decode_threads = (int)config.GetInteger("downloader", "decode_threads", max(1u, thread::hardware_concurrency()));
+    if (decode_threads <= 0)
+    {
+        log->error("Invalid number of decode threads: {}", decode_threads);
+        exit(EX_CONFIG);
+    }
+
+    // Read in the block cache settings; 1 GB of blocks by default
+    cache_dir = config.Get("downloader", "cache_dir", base_dir + "/.cache");
+    cache_bytes = config.GetInteger("downloader", "cache_bytes", 1L << 30);
+    if (cache_bytes < 0)
+    {
+        log->error("Invalid block cache size: {}", cache_bytes);
+        exit(EX_CONFIG);
+    }
+    reuse_local_files = config.GetBoolean("downloader", "reuse_local_files", false);
+    if (chunking == "cdc")
+    {
+        // local files can only be matched if they are cut like the uploader cuts them
+        int uploader_blocksize = (int)config.GetInteger("uploader", "blocksize", blocksize);
+        cdc_avg_size = (int)config.GetInteger("uploader", "cdc_avg_size", uploader_blocksize);
+        cdc_min_size = (int)config.GetInteger("uploader", "cdc_min_size", cdc_avg_size / 4);
+        cdc_max_size = (int)config.GetInteger("uploader", "cdc_max_size", 8 * (long)cdc_avg_size);
+        if (cdc_min_size <= 0 || cdc_avg_size <= cdc_min_size || cdc_max_size <= cdc_avg_size)
+        {
+            log->error("Invalid chunk sizes: min {}, avg {}, max {}", cdc_min_size, cdc_avg_size, cdc_max_size);
+            exit(EX_CONFIG);
+        }
+    }
+
+    // Read in how many pings time each server at startup, and how often to
+    // ping them all again while downloading; the same as the uploader
+    // unless set here
+    rtt_probes = (int)config.GetInteger("downloader", "rtt_probes", config.GetInteger("uploader", "rtt_probes", 8));
+    if (rtt_probes <= 0)
+    {
+        log->error("Invalid number of RTT probes: {}", rtt_probes);
+        exit(EX_CONFIG);
+    }
+    probe_interval_ms = config.GetInteger("downloader", "probe_interval_ms", config.GetInteger("uploader", "probe_interval_ms", 1000));
+    if (probe_interval_ms < 0)
+    {
+        log->error("Invalid probe interval: {}", probe_interval_ms);
+        exit(EX_CONFIG);
+    }
+
+    // Read in the erasure code the uploader's erasure policy uses, to find
+    // the fragments of blocks no server holds whole; the same as the
+    // uploader unless set here
+    erasure_data = (int)config.GetInteger("downloader", "erasure_data", config.GetInteger("uploader", "erasure_data", 2));
+    erasure_parity = (int)config.GetInteger("downloader", "erasure_parity", config.GetInteger("uploader", "erasure_parity", 1));
+    if (erasure_data <= 0 || erasure_parity < 0 || erasure_data + erasure_parity > 255)
+    {
+        log->error("Invalid erasure code: {} data, {} parity fragments", erasure_data, erasure_parity);
+        exit(EX_CONFIG);
+    }
+
+    // Read in how to find the servers holding a block: from their
+    // inventories, or by rendezvous hashing, as the uploader does with that
+    // policy, and then by default
+    string policy = config.Get("uploader", "policy", "");
+    locate = config.Get("downloader", "locate", policy == RENDEZVOUS ? RENDEZVOUS : "inventory");
+    if (locate != "inventory" && locate != RENDEZVOUS)
+    {
+        log->error("Invalid way to locate blocks: {}", locate);
+        exit(EX_CONFIG);
+    }
+    replicas = (int)config.GetInteger("uploader", "replicas", 2);
+    if (replicas <= 0)
+    {
+        log->error("Invalid number of replicas: {}", replicas);
+        exit(EX_CONFIG);
+    }
+    log->info("Locating blocks by {}", locate);
+
+    // Read in where to keep the block inventories; the uploader skips
+    // dotfiles, so the default can live next to the downloaded files
+    inventory_file = config.Get("downloader", "inventory_file", base_dir + "/.inventory");
+    log->info("Using inventory file {}", inventory_file);
+
     num_servers = (int)config.GetInteger("ssd", "num_servers", -1);
     if (num_servers <= 0)
     {
@@ -167,74 +475,217 @@ void Downloader::download()
         }
     }
 
-    vector<float> avg_durations;
-    vector<list<string>> all_serv_hashlists;
-
-    // calc rtt for all servers and get all their
-    for (int i = 0; i < num_servers; ++i)
+    // measure the RTT to every server at once, and keep measuring it
+    LatencyTracker latency(ssdhosts, ssdports, RPC_TIMEOUT);
+    latency.probe(rtt_probes);
+    latency.report();
+    if (probe_interval_ms > 0)
     {
-        avg_durations.push_back(__calcSingleRTT(clients[i], i));
+        latency.start(milliseconds(probe_interval_ms));
+    }
 
-        log->info("Getting block hashlist from server #{}", i);
-        all_serv_hashlists.push_back(clients[i]->call("get_all_blocks_hashlist").as<list<string>>());
+    // every server must speak at least version 2 before we sync with it
+    protocol = negotiate_protocol(clients);
+
+    // with rendezvous hashing every block's holders follow from its hash,
+    // so there is no inventory to sync, however many blocks are stored
+    vector<ServerInventory> inventories(num_servers);
+    unique_ptr<RendezvousPolicy> rendezvous;
+    if (locate == RENDEZVOUS)
+    {
+        vector<string> addresses;
+        for (int i = 0; i < num_servers; ++i)
+        {
+            addresses.push_back(ssdhosts[i] + ":" + std::to_string(ssdports[i]));
+        }
+        rendezvous.reset(new RendezvousPolicy(addresses, replicas));
+    }
+    else
+    {
+        load_inventory(inventories);
     }
 
-    // argsort - indieces contains index corresponding to sorted values in avg_durations
-    vector<int> indices(avg_durations.size());
-    size_t n(0);
-    generate(begin(indices), end(indices), [&] { return n++; });
+    // bring our digest of the blocks every server holds up to date,
+    // fetching only the blocks stored since our last run
+    for (int i = 0; !rendezvous && i < num_servers; ++i)
+    {
+        ServerInventory &inv = inventories[i];
+        log->info("Syncing block inventory of server #{} from seq {}", i, inv.next_seq);
+        auto delta = clients[i]->call("get_blocks_since", inv.epoch, inv.next_seq).as<tuple<uint64_t, uint64_t, string>>();
+
+        if (get<0>(delta) != inv.epoch)
+        {
+            // the server restarted (or we never saw it): start over
+            log->info("Server #{} has a new epoch, doing a full sync", i);
+            inv.digest.clear();
+            inv.epoch = get<0>(delta);
+        }
+        inv.digest.add(get<2>(delta));
+        log->info("Server #{} stored {} new blocks, holds {} blocks", i,
+                  get<2>(delta).size() / sizeof(uint64_t), inv.digest.size());
+        inv.next_seq = get<1>(delta);
+    }
+    if (!rendezvous)
+    {
+        save_inventory(inventories);
+    }
 
-    sort(begin(indices), end(indices), [&](int i1, int i2) {
-        return avg_durations[i1] < avg_durations[i2];
-    });
+    // servers from closest to farthest right now
+    vector<int> indices = latency.ranking();
 
     // get fim from localhost (closest server)
     log->info("Getting FileInfoMap from server #{}", indices[0]);
-    FileInfoMap remote_index = clients[indices[0]]->call("get_fileinfo_map").as<FileInfoMap>();
+    PackedFileInfoMap remote_index = clients[indices[0]]->call("get_fileinfo_map_v2").as<PackedFileInfoMap>();
+
+    // blocks per get_blocks call; blocks are at most blocksize bytes
+    size_t batch_blocks = max(1, batch_bytes / blocksize);
+
+    // Without parallel mode, every block comes from the closest server that
+    // holds it, one batch at a time, as the assignment prescribes. The other
+    // holders are only used for retries and hedges.
+    DownloadEngine engine(clients, latency, batch_blocks, parallel ? window : 1, parallel,
+                          hedge, hedge_percentile, protocol, decode_threads);
+
+    // blocks fetched by earlier runs, and blocks of the files already in
+    // base_dir, need not be fetched again
+    BlockHasher hasher(BlockHasher::detect());
+    BlockCache cache(cache_dir, cache_bytes, hasher);
+    cache.open();
+    if (reuse_local_files) {
+        index_local_files(cache, hasher);
+    }
+
+    // rebuilds blocks stored as fragments by the erasure policy
+    ErasureCode code(erasure_data, erasure_parity);
 
     unsigned int total_duration = 0;
+    size_t total_bytes = 0;
 
-    // warning: three nested iterations to download all blocks!
     for(const auto& key_val : remote_index){
         //get the file name of the remote_index
         string remote_filename = key_val.first;
-        FileInfo remote_fileinfo = key_val.second; // a tuple
-        list<string> remote_hashlist = get<1>(remote_fileinfo);
-
-        // download blocks
-        list<string> blocks;
+        const PackedFileInfo &remote_fileinfo = key_val.second; // a tuple
+        vector<BlockHash> remote_hashlist = BlockHash::unpack(get<1>(remote_fileinfo));
 
         auto start = high_resolution_clock::now(); // start the timer
 
-        // for each block, download it from closest available server
-        for (const string &hash : remote_hashlist) {
-
-            // iterate through all available servers from closest to farthest
-            // until a server containing the given block hash is found.
-            for (size_t find_serv_idx = 0; find_serv_idx < indices.size(); ++find_serv_idx) {
-                //get the closest hashlist so far
-                list<string> &cur_serv_hashlist = all_serv_hashlists[indices[find_serv_idx]];
-                auto hash_exists_it = find(cur_serv_hashlist.begin(),cur_serv_hashlist.end(),hash);
-
-                // block found! mission complete!
-                if (hash_exists_it != cur_serv_hashlist.end()) {
-                    // hash is guaranteed to exist on server #find_serv_idx
-                    blocks.push_back(clients[indices[find_serv_idx]]->call("get_block", hash).as<string>());
-                    break;
-                } // end if
-            } // end finding closest server for current block
+        log->info("Reconstituting file '{}'", remote_filename);
+        FileAssembler file(base_dir + "/" + remote_filename, remote_hashlist.size(), blocksize, chunking == "fixed");
+        if (!file.open()) {
+            continue;
+        }
+
+        // take what we can from the block cache and local files, and list
+        // the servers holding each of the other blocks, closest first as of
+        // the replies and probes so far
+        indices = latency.ranking();
+        vector<BlockHash> fetch_hashlist;
+        vector<size_t> fetch_idxs; // position in the file of each block to fetch
+        vector<vector<int>> holders;
+        vector<int> groups;        // per fetched block: the rebuild it is a fragment of, or -1
+        vector<int> fragment_idxs; // per fetched block: which fragment it is
+        vector<Rebuild> rebuilds;
+        string cached;
+        for (size_t block_idx = 0; block_idx < remote_hashlist.size(); ++block_idx) {
+            const BlockHash &hash = remote_hashlist[block_idx];
+            if (cache.get(hash, cached)) {
+                file.write(block_idx, cached);
+                continue;
+            }
+            fetch_hashlist.push_back(hash);
+            fetch_idxs.push_back(block_idx);
+            holders.push_back(find_holders(inventories, rendezvous.get(), indices, hash));
+            groups.push_back(-1);
+            fragment_idxs.push_back(-1);
+            if (!holders.back().empty()) {
+                continue;
+            }
+
+            // no server holds the block whole: fetch all of its fragments
+            // at once, and rebuild it from whichever arrive first
+            vector<vector<int>> fragment_holders;
+            bool any_holder = false;
+            for (int index = 0; index < code.fragments(); ++index) {
+                fragment_holders.push_back(find_holders(inventories, rendezvous.get(), indices, ErasureCode::fragment_hash(hash, index)));
+                any_holder = any_holder || !fragment_holders.back().empty();
+            }
+            if (!any_holder) {
+                continue;
+            }
+            fetch_hashlist.pop_back();
+            fetch_idxs.pop_back();
+            holders.pop_back();
+            groups.pop_back();
+            fragment_idxs.pop_back();
+            for (int index = 0; index < code.fragments(); ++index) {
+                fetch_hashlist.push_back(ErasureCode::fragment_hash(hash, index));
+                fetch_idxs.push_back(block_idx);
+                holders.push_back(fragment_holders[index]);
+                groups.push_back(rebuilds.size());
+                fragment_idxs.push_back(index);
+            }
+            rebuilds.push_back(Rebuild{hash, vector<string>(code.fragments()), 0, false});
         } // end iterating all block hashes of current file
 
+        // download the rest, writing each block to disk, and to the cache, as
+        // soon as it arrives
+        mutex rebuild_lock;
+        bool fetched = engine.fetch(fetch_hashlist, holders, [&](size_t fetch_idx, const string &block) {
+            if (groups[fetch_idx] < 0) {
+                file.write(fetch_idxs[fetch_idx], block);
+                cache.put(fetch_hashlist[fetch_idx], block);
+                return;
+            }
+
+            // once data() fragments are in, every fragment rebuilds the block
+            // anew until a rebuild matches its hash
+            Rebuild &rebuild = rebuilds[groups[fetch_idx]];
+            string rebuilt;
+            {
+                lock_guard<mutex> guard(rebuild_lock);
+                if (rebuild.rebuilt) {
+                    return;
+                }
+                rebuild.fragments[fragment_idxs[fetch_idx]] = block;
+                if (++rebuild.arrived < code.data()) {
+                    return;
+                }
+                rebuild.rebuilt = rebuild_block(code, hasher, rebuild, fragment_idxs[fetch_idx], rebuilt);
+            }
+            if (!rebuild.rebuilt) {
+                log->error("Block with hash {} could not be rebuilt from {} fragments, fetching another",
+                           rebuild.hash.hex(), rebuild.arrived);
+                engine.need_another(fetch_idx);
+                return;
+            }
+            file.write(fetch_idxs[fetch_idx], rebuilt);
+            cache.put(rebuild.hash, rebuilt);
+        }, groups, code.data());
+        if (!fetched) {
+            log->error("Some blocks of file {} could not be downloaded", remote_filename);
+        }
+        if (file.finish()) {
+            log->info("File '{}' reconstitution successful", remote_filename);
+        }
+
         auto stop = high_resolution_clock::now();
         auto duration = duration_cast<milliseconds>(stop - start).count();
 
-        log->error("Download time of file {} is {} milliseconds.", remote_filename, duration);
+        size_t file_bytes = file.bytes();
+
+        log->error("Download time of file {} is {} milliseconds: {:.2f} MB/s.",
+                   remote_filename, duration, duration > 0 ? file_bytes / 1e3 / duration : 0.0);
 
         total_duration += duration;
-        create_file_from_blocklist(remote_filename, blocks);
+        total_bytes += file_bytes;
     } // end iterating all files in fim
 
-    log->error("Total download time is {} milliseconds.", total_duration);
+    log->error("Total download time is {} milliseconds for {:.1f} MB: {:.2f} MB/s.",
+               total_duration, total_bytes / 1e6, total_duration > 0 ? total_bytes / 1e3 / total_duration : 0.0);
+    engine.report();
+    cache.report();
+    latency.stop();
+    latency.report();
 
     // Delete the clients
     for (int i = 0; i < num_servers; ++i)
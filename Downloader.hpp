@@ -8,6 +8,10 @@
 #include "rpc/client.h"
 
 #include "SurfStoreTypes.hpp"
+#include "BlockDigest.hpp"
+#include "BlockCache.hpp"
+#include "BlockHasher.hpp"
+#include "PlacementPolicy.hpp"
 #include "logger.hpp"
 
 using namespace std;
@@ -26,11 +30,54 @@ class Downloader
 
     string base_dir;
     int blocksize;
+    int batch_bytes; // payload bytes per get_blocks call
+    bool parallel;   // stripe blocks over every replica instead of the closest one
+    int window;      // get_blocks calls in flight per server in parallel mode
+    bool hedge;      // re-request slow batches from the next-closest replica
+    double hedge_percentile; // latency percentile after which a batch is hedged
+    string inventory_file;   // the servers' block inventories, kept between runs
+    int protocol;            // negotiated with the servers, see Protocol.hpp
+    int decode_threads;      // threads decompressing blocks, see DownloadEngine.hpp
+    string chunking;         // how the uploader cut files: "fixed" or "cdc", see FileAssembler.hpp
+    int cdc_min_size;        // the uploader's chunk sizes, to cut local files the same way
+    int cdc_avg_size;
+    int cdc_max_size;
+    string cache_dir;        // the block cache, see BlockCache.hpp
+    long cache_bytes;
+    bool reuse_local_files;  // serve blocks from the files already in base_dir
+    int rtt_probes;          // pings per server at startup, see LatencyTracker.hpp
+    long probe_interval_ms;  // between background pings; 0 for none
+    int erasure_data;        // the uploader's erasure code, see ErasureCode.hpp
+    int erasure_parity;
+    string locate;           // "inventory" or "rendezvous", see PlacementPolicy.hpp
+    int replicas;            // copies of each block rendezvous placed
 
     int num_servers;
     vector<string> ssdhosts;
     vector<int> ssdports;
-    void create_file_from_blocklist(string filename, list<string>& blocks);
+
+    // what we know about the blocks held by one server, see BlockInventory.hpp
+    struct ServerInventory
+    {
+        uint64_t epoch;    // 0 if we never synced with this server
+        uint64_t next_seq; // first sequence number we have not seen
+        BlockDigest digest;
+    };
+    // a block no server holds whole, rebuilt from its fragments
+    struct Rebuild
+    {
+        BlockHash hash;
+        vector<string> fragments; // empty until arrived
+        int arrived;
+        bool rebuilt;
+    };
+    vector<int> find_holders(vector<ServerInventory> &inventories, const RendezvousPolicy *rendezvous,
+                             const vector<int> &indices, const BlockHash &hash);
+    void index_local_files(BlockCache &cache, const BlockHasher &hasher);
+    bool rebuild_block(const ErasureCode &code, const BlockHasher &hasher, const Rebuild &rebuild, int newest,
+                       string &block);
+    void load_inventory(vector<ServerInventory>& inventories);
+    void save_inventory(vector<ServerInventory>& inventories);
 };
 
 #endif // DOWNLOADER_HPP
@@ -0,0 +1,339 @@
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ERASURECODE_X86 1
+#endif
+
+#include "ErasureCode.hpp"
+
+using namespace std;
+
+// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1, as ISA-L and
+// Jerasure use: log and exp tables, and every product
+struct GaloisField
+{
+    uint8_t exp[512];
+    uint8_t log[256];
+    uint8_t product[256][256];
+
+    GaloisField()
+    {
+        unsigned x = 1;
+        for (int i = 0; i < 255; ++i)
+        {
+            exp[i] = exp[i + 255] = (uint8_t)x;
+            log[x] = (uint8_t)i;
+            x <<= 1;
+            if (x & 0x100)
+            {
+                x ^= 0x11d;
+            }
+        }
+        exp[510] = exp[511] = exp[0];
+        log[0] = 0;
+        for (int a = 0; a < 256; ++a)
+        {
+            for (int b = 0; b < 256; ++b)
+            {
+                product[a][b] = a == 0 || b == 0 ? 0 : exp[log[a] + log[b]];
+            }
+        }
+    }
+
+    uint8_t mul(uint8_t a, uint8_t b) const { return product[a][b]; }
+    uint8_t inv(uint8_t a) const { return exp[255 - log[a]]; }
+};
+
+static const GaloisField &gf()
+{
+    static const GaloisField field;
+    return field;
+}
+
+#ifdef ERASURECODE_X86
+// dst ^= c * src, 16 bytes at a time; lo and hi hold c times every low and
+// every high nibble
+__attribute__((target("ssse3")))
+static size_t mul_add_ssse3(uint8_t *dst, const uint8_t *src, const uint8_t lo[16], const uint8_t hi[16], size_t length)
+{
+    __m128i tlo = _mm_loadu_si128((const __m128i *)lo);
+    __m128i thi = _mm_loadu_si128((const __m128i *)hi);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i l = _mm_and_si128(s, mask);
+        __m128i h = _mm_and_si128(_mm_srli_epi64(s, 4), mask);
+        __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tlo, l), _mm_shuffle_epi8(thi, h));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, p));
+    }
+    return i;
+}
+
+// the same 32 bytes at a time; vpshufb looks up within each 128-bit half,
+// so both halves get the whole table
+__attribute__((target("avx2")))
+static size_t mul_add_avx2(uint8_t *dst, const uint8_t *src, const uint8_t lo[16], const uint8_t hi[16], size_t length)
+{
+    __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+    __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i l = _mm256_and_si256(s, mask);
+        __m256i h = _mm256_and_si256(_mm256_srli_epi64(s, 4), mask);
+        __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, l), _mm256_shuffle_epi8(thi, h));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, p));
+    }
+    return i;
+}
+#endif // ERASURECODE_X86
+
+ErasureCode::Engine ErasureCode::detect()
+{
+    if (supported(AVX2))
+    {
+        return AVX2;
+    }
+    if (supported(SSSE3))
+    {
+        return SSSE3;
+    }
+    return SCALAR;
+}
+
+bool ErasureCode::supported(Engine engine)
+{
+    if (engine == SCALAR)
+    {
+        return true;
+    }
+#ifdef ERASURECODE_X86
+    // also checks that the OS saves the AVX registers
+    return engine == AVX2 ? __builtin_cpu_supports("avx2") : __builtin_cpu_supports("ssse3");
+#else
+    return false;
+#endif
+}
+
+const char *ErasureCode::name(Engine engine)
+{
+    switch (engine)
+    {
+    case AVX2:
+        return "avx2";
+    case SSSE3:
+        return "ssse3";
+    default:
+        return "scalar";
+    }
+}
+
+ErasureCode::ErasureCode(int t_data, int t_parity, Engine t_engine)
+    : k(t_data), m(t_parity), used(supported(t_engine) ? t_engine : SCALAR), matrix((t_data + t_parity) * t_data, 0)
+{
+    const GaloisField &field = gf();
+    for (int row = 0; row < k; ++row)
+    {
+        matrix[row * k + row] = 1;
+    }
+    // Cauchy rows: 1 / (x_i + y_j) with x_i = k + i and y_j = j all distinct
+    for (int i = 0; i < m; ++i)
+    {
+        for (int j = 0; j < k; ++j)
+        {
+            matrix[(k + i) * k + j] = field.inv((uint8_t)((k + i) ^ j));
+        }
+    }
+}
+
+void ErasureCode::encode(const string &block, BlockCodec::Codec codec, vector<string> &out) const
+{
+    size_t slice = (block.size() + k - 1) / k;
+    uint32_t length = (uint32_t)block.size();
+
+    // reuses out's buffers, which saves faulting in fresh pages for every block
+    out.resize(fragments());
+    for (int index = 0; index < fragments(); ++index)
+    {
+        string &fragment = out[index];
+        fragment.assign(HEADER_SIZE + slice, '\0');
+        fragment[0] = (char)k;
+        fragment[1] = (char)m;
+        fragment[2] = (char)index;
+        fragment[3] = (char)codec;
+        memcpy(&fragment[4], &length, sizeof(length));
+
+        // data fragments are the block's own bytes
+        if (index < k && (size_t)index * slice < block.size())
+        {
+            size_t offset = index * slice;
+            memcpy(&fragment[HEADER_SIZE], block.data() + offset, min(slice, block.size() - offset));
+        }
+    }
+
+    for (int index = k; index < fragments(); ++index)
+    {
+        uint8_t *dst = (uint8_t *)&out[index][HEADER_SIZE];
+        for (int j = 0; j < k; ++j)
+        {
+            mul_add(dst, (const uint8_t *)out[j].data() + HEADER_SIZE, matrix[index * k + j], slice);
+        }
+    }
+}
+
+bool ErasureCode::decode(const vector<const string *> &in, string &block, BlockCodec::Codec &codec) const
+{
+    const GaloisField &field = gf();
+
+    // the first k fragments that agree on the block
+    vector<int> rows;
+    const string *first = nullptr;
+    for (int index = 0; index < (int)in.size() && index < fragments() && (int)rows.size() < k; ++index)
+    {
+        const string *fragment = in[index];
+        if (fragment == nullptr || fragment->size() < HEADER_SIZE || (uint8_t)(*fragment)[0] != k ||
+            (uint8_t)(*fragment)[1] != m || (uint8_t)(*fragment)[2] != index)
+        {
+            continue;
+        }
+        if (first == nullptr)
+        {
+            first = fragment;
+        }
+        else if (fragment->size() != first->size() || fragment->compare(3, 5, *first, 3, 5) != 0)
+        {
+            continue;
+        }
+        rows.push_back(index);
+    }
+    if ((int)rows.size() < k)
+    {
+        return false;
+    }
+
+    uint32_t length;
+    memcpy(&length, first->data() + 4, sizeof(length));
+    size_t slice = first->size() - HEADER_SIZE;
+    if (!BlockCodec::valid((uint8_t)(*first)[3]) || length > slice * k)
+    {
+        return false;
+    }
+    codec = (BlockCodec::Codec)(*first)[3];
+
+    // invert the rows of the generator matrix we have, Gauss-Jordan
+    vector<uint8_t> a(k * k), inv(k * k, 0);
+    for (int r = 0; r < k; ++r)
+    {
+        memcpy(&a[r * k], &matrix[rows[r] * k], k);
+        inv[r * k + r] = 1;
+    }
+    for (int col = 0; col < k; ++col)
+    {
+        int pivot = col;
+        while (pivot < k && a[pivot * k + col] == 0)
+        {
+            ++pivot;
+        }
+        if (pivot == k)
+        {
+            return false; // cannot happen with a Cauchy matrix
+        }
+        for (int j = 0; j < k; ++j)
+        {
+            swap(a[col * k + j], a[pivot * k + j]);
+            swap(inv[col * k + j], inv[pivot * k + j]);
+        }
+        uint8_t scale = field.inv(a[col * k + col]);
+        for (int j = 0; j < k; ++j)
+        {
+            a[col * k + j] = field.mul(a[col * k + j], scale);
+            inv[col * k + j] = field.mul(inv[col * k + j], scale);
+        }
+        for (int r = 0; r < k; ++r)
+        {
+            uint8_t factor = a[r * k + col];
+            if (r == col || factor == 0)
+            {
+                continue;
+            }
+            for (int j = 0; j < k; ++j)
+            {
+                a[r * k + j] ^= field.mul(factor, a[col * k + j]);
+                inv[r * k + j] ^= field.mul(factor, inv[col * k + j]);
+            }
+        }
+    }
+
+    // data slice j is row j of the inverse applied to the fragments we
+    // have; a data fragment we have is copied as it is
+    block.assign(slice * k, '\0');
+    for (int j = 0; j < k; ++j)
+    {
+        uint8_t *dst = (uint8_t *)&block[j * slice];
+        if (in[j] != nullptr && find(rows.begin(), rows.end(), j) != rows.end())
+        {
+            memcpy(dst, in[j]->data() + HEADER_SIZE, slice);
+            continue;
+        }
+        for (int r = 0; r < k; ++r)
+        {
+            mul_add(dst, (const uint8_t *)in[rows[r]]->data() + HEADER_SIZE, inv[j * k + r], slice);
+        }
+    }
+    block.resize(length);
+    return true;
+}
+
+BlockHash ErasureCode::fragment_hash(const BlockHash &hash, int index)
+{
+    // splitmix64 of the index, so every fragment's key is far from the others
+    uint64_t z = (uint64_t)(index + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+
+    BlockHash out = hash;
+    for (size_t i = 0; i < sizeof(z); ++i)
+    {
+        out.bytes[i] ^= (uint8_t)(z >> (8 * i));
+    }
+    return out;
+}
+
+// dst ^= c * src
+void ErasureCode::mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length) const
+{
+    if (c == 0)
+    {
+        return;
+    }
+    const uint8_t *row = gf().product[c];
+    size_t done = 0;
+#ifdef ERASURECODE_X86
+    if (used != SCALAR)
+    {
+        uint8_t lo[16], hi[16];
+        for (int x = 0; x < 16; ++x)
+        {
+            lo[x] = row[x];
+            hi[x] = row[x << 4];
+        }
+        done = used == AVX2 ? mul_add_avx2(dst, src, lo, hi, length) : mul_add_ssse3(dst, src, lo, hi, length);
+    }
+#endif
+    for (size_t i = done; i < length; ++i)
+    {
+        dst[i] ^= row[src[i]];
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef ERASURECODE_HPP
+#define ERASURECODE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "BlockCodec.hpp"
+#include "BlockHash.hpp"
+
+using namespace std;
+
+/**
+ * Systematic Reed-Solomon coding of blocks over GF(2^8).
+ *
+ * A block is cut into data() equal slices, the last one padded with zeros,
+ * and parity() parity slices are computed from them; any data() of the
+ * fragments() slices rebuild the block. The generator matrix is the
+ * identity on top of a Cauchy matrix, so every square submatrix of data()
+ * rows is invertible and data fragments are the block's own bytes.
+ *
+ * Every fragment starts with an 8-byte header:
+ *
+ *   | data:u8 | parity:u8 | index:u8 | codec:u8 | length:u32 |
+ *
+ * where codec and length are those of the block as the uploader stores it,
+ * possibly compressed, so the downloader needs nothing but the fragments.
+ *
+ * Multiplying a slice by a constant, the inner loop of both encoding and
+ * rebuilding, looks the products of each byte's two nibbles up in 16-entry
+ * tables with pshufb, 16 (SSSE3) or 32 (AVX2) bytes at a time, as ISA-L
+ * and Jerasure do. The engine is picked with cpuid at runtime like
+ * BlockHasher's. A code is stateless and may be shared by any number of
+ * threads.
+ */
+class ErasureCode
+{
+  public:
+    enum Engine
+    {
+        SCALAR,
+        SSSE3,
+        AVX2,
+    };
+
+    static const size_t HEADER_SIZE = 8;
+
+    // the best engine this machine supports
+    static Engine detect();
+    static bool supported(Engine engine);
+    static const char *name(Engine engine);
+
+    // t_data + t_parity must be at most 255
+    ErasureCode(int t_data, int t_parity, Engine t_engine = detect());
+
+    int data() const { return k; }
+    int parity() const { return m; }
+    int fragments() const { return k + m; }
+    Engine engine() const { return used; }
+
+    // cut block, stored with codec, into fragments() fragments; the strings
+    // already in out are reused
+    void encode(const string &block, BlockCodec::Codec codec, vector<string> &out) const;
+
+    // rebuild a block from in, which holds fragments() entries, the missing
+    // ones nullptr; at least data() must be present. False if there
+    // are too few, or they do not belong to the same block. in must not
+    // point into block.
+    bool decode(const vector<const string *> &in, string &block, BlockCodec::Codec &codec) const;
+
+    // the key fragment index of the block with hash is stored under. Its
+    // first 8 bytes differ from hash's, so server digests tell them apart.
+    static BlockHash fragment_hash(const BlockHash &hash, int index);
+
+  protected:
+    int k;
+    int m;
+    Engine used;
+    vector<uint8_t> matrix; // fragments() x k generator matrix, row-major
+
+    void mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length) const;
+};
+
+#endif // ERASURECODE_HPP
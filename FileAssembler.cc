@@ -0,0 +1,224 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <string>
+
+#include "logger.hpp"
+#include "FileAssembler.hpp"
+
+using namespace std;
+
+// path with its file name turned into a dotfile with the given suffix
+static string hidden_path(const string &path, const string &suffix)
+{
+    size_t slash = path.rfind('/');
+    size_t name = slash == string::npos ? 0 : slash + 1;
+    return path.substr(0, name) + "." + path.substr(name) + suffix;
+}
+
+FileAssembler::FileAssembler(const string &t_path, size_t t_blocks, size_t t_blocksize, bool t_fixed)
+    : path(t_path), tmp_path(hidden_path(t_path, ".part")), spool_path(hidden_path(t_path, ".spool")),
+      blocks(t_blocks), blocksize(t_blocksize), fixed(t_fixed), fd(-1), spool_fd(-1),
+      failed(false), written(0), length(0), file_size(0), next(0), offset(0), spool_size(0)
+{
+}
+
+FileAssembler::~FileAssembler()
+{
+    remove_files();
+}
+
+bool FileAssembler::open()
+{
+    auto log = logger();
+
+    fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        log->error("Unable to create {}: {}", tmp_path, strerror(errno));
+        return false;
+    }
+
+    // Reserve the space up front so the file does not fragment as blocks
+    // land all over it. For content-defined chunks this is only an estimate;
+    // finish() trims whatever is left over. Not every file system supports
+    // fallocate, and writing works without it.
+    uint64_t estimate = (uint64_t)blocks * blocksize;
+    if (estimate > 0 && fallocate(fd, 0, 0, estimate) != 0)
+    {
+        log->info("Unable to preallocate {} bytes for {}: {}", estimate, tmp_path, strerror(errno));
+    }
+    return true;
+}
+
+void FileAssembler::write(size_t block_idx, const string &block)
+{
+    if (fixed)
+    {
+        write_fixed(block_idx, block);
+    }
+    else
+    {
+        write_ordered(block_idx, block);
+    }
+}
+
+// block i lives at i * blocksize, whatever arrived before it
+void FileAssembler::write_fixed(size_t block_idx, const string &block)
+{
+    auto log = logger();
+
+    bool last = block_idx + 1 == blocks;
+    if (block.size() > blocksize || (!last && block.size() != blocksize))
+    {
+        log->error("Block {} of {} is {} bytes, not {}; was it uploaded with chunking=cdc?",
+                   block_idx, path, block.size(), blocksize);
+        lock_guard<mutex> guard(lock);
+        failed = true;
+        return;
+    }
+
+    // blocks never overlap, so their writes need no lock
+    uint64_t at = (uint64_t)block_idx * blocksize;
+    bool ok = write_at(fd, block.data(), block.size(), at);
+
+    lock_guard<mutex> guard(lock);
+    failed = failed || !ok;
+    ++written;
+    length += block.size();
+    file_size = max(file_size, at + block.size());
+}
+
+/**
+ * A chunk's offset is the length of every chunk before it, so chunks are
+ * written in order. One that arrives before its predecessors is appended to
+ * the spool file, and copied into place once they have all been written.
+ * The lock is held throughout, which serializes the writes of one file.
+ */
+void FileAssembler::write_ordered(size_t block_idx, const string &block)
+{
+    auto log = logger();
+    lock_guard<mutex> guard(lock);
+
+    ++written;
+    length += block.size();
+
+    if (block_idx != next)
+    {
+        if (spool_fd < 0)
+        {
+            spool_fd = ::open(spool_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (spool_fd < 0)
+            {
+                log->error("Unable to create {}: {}", spool_path, strerror(errno));
+                failed = true;
+                return;
+            }
+        }
+        failed = failed || !write_at(spool_fd, block.data(), block.size(), spool_size);
+        spooled[block_idx] = make_pair(spool_size, block.size());
+        spool_size += block.size();
+        return;
+    }
+
+    failed = failed || !write_at(fd, block.data(), block.size(), offset);
+    offset += block.size();
+    ++next;
+
+    string buffer;
+    for (auto it = spooled.find(next); it != spooled.end(); it = spooled.find(next))
+    {
+        buffer.resize(it->second.second);
+        if (!buffer.empty() &&
+            pread(spool_fd, &buffer[0], buffer.size(), it->second.first) != (ssize_t)buffer.size())
+        {
+            log->error("Unable to read block {} of {} back from {}: {}", next, path, spool_path, strerror(errno));
+            failed = true;
+        }
+        failed = failed || !write_at(fd, buffer.data(), buffer.size(), offset);
+        offset += buffer.size();
+        spooled.erase(it);
+        ++next;
+    }
+}
+
+bool FileAssembler::finish()
+{
+    auto log = logger();
+    lock_guard<mutex> guard(lock);
+
+    if (fd < 0 || failed || written != blocks)
+    {
+        log->error("File {} is incomplete, keeping the old copy", path);
+        return false;
+    }
+
+    uint64_t size = fixed ? file_size : offset;
+    if (ftruncate(fd, size) != 0)
+    {
+        log->error("Unable to truncate {}: {}", tmp_path, strerror(errno));
+        return false;
+    }
+    close(fd);
+    fd = -1;
+
+    if (rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        log->error("Unable to rename {} to {}: {}", tmp_path, path, strerror(errno));
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+uint64_t FileAssembler::bytes()
+{
+    lock_guard<mutex> guard(lock);
+    return length;
+}
+
+// pwrite all of data, however many calls that takes
+bool FileAssembler::write_at(int to, const char *data, size_t size, uint64_t at)
+{
+    auto log = logger();
+
+    while (size > 0)
+    {
+        ssize_t n = pwrite(to, data, size, at);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            log->error("Unable to write {} bytes of {}: {}", size, path, strerror(errno));
+            return false;
+        }
+        data += n;
+        size -= n;
+        at += n;
+    }
+    return true;
+}
+
+// drop the spool file, and the temporary file unless finish() renamed it
+void FileAssembler::remove_files()
+{
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+        unlink(tmp_path.c_str());
+    }
+    if (spool_fd >= 0)
+    {
+        close(spool_fd);
+        spool_fd = -1;
+        unlink(spool_path.c_str());
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef FILEASSEMBLER_HPP
+#define FILEASSEMBLER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "logger.hpp"
+
+using namespace std;
+
+/**
+ * Writes a downloaded file block by block, in whatever order the blocks
+ * arrive, so a file is never held in memory as a whole and disk writes
+ * overlap with the fetches still in flight.
+ *
+ * Blocks go into a temporary dotfile next to path (the uploader skips
+ * dotfiles), preallocated with fallocate for blocks * blocksize bytes. Once
+ * every block is written, finish() trims the file to its real length and
+ * renames it over path, so readers see either the old file or the whole new
+ * one. A file that was not finished is removed again.
+ *
+ * With fixed blocksize blocks, block i starts at i * blocksize, so each
+ * block is written with one pwrite as soon as it arrives. Content-defined
+ * chunks (see Chunker.hpp) have no such offset: a chunk is written once the
+ * chunks before it are, and one that arrives early waits in a spool file
+ * instead of in memory.
+ *
+ * write() may be called from several threads at once.
+ */
+class FileAssembler
+{
+  public:
+    // fixed: every block but the last is exactly blocksize bytes
+    FileAssembler(const string &t_path, size_t t_blocks, size_t t_blocksize, bool t_fixed);
+    ~FileAssembler();
+
+    // create and preallocate the temporary file. False if it can't be created.
+    bool open();
+
+    // write block block_idx of the file
+    void write(size_t block_idx, const string &block);
+
+    // put the file in place. False, leaving path alone, if a block is
+    // missing or could not be written.
+    bool finish();
+
+    // bytes of blocks written so far
+    uint64_t bytes();
+
+  protected:
+    string path;
+    string tmp_path;
+    string spool_path;
+    size_t blocks;
+    size_t blocksize;
+    bool fixed;
+
+    int fd;
+    int spool_fd;
+
+    mutex lock; // guards everything below
+    bool failed;
+    size_t written;     // blocks written, including spooled ones
+    uint64_t length;    // bytes of blocks written, including spooled ones
+    uint64_t file_size; // with fixed blocks: the end of the furthest block
+    size_t next;        // without fixed blocks: the first block not in place yet
+    uint64_t offset;    // where next goes
+    uint64_t spool_size;
+    map<size_t, pair<uint64_t, size_t>> spooled; // block_idx -> (spool offset, length)
+
+    void write_fixed(size_t block_idx, const string &block);
+    void write_ordered(size_t block_idx, const string &block);
+    bool write_at(int to, const char *data, size_t size, uint64_t at);
+    void remove_files();
+};
+
+#endif // FILEASSEMBLER_HPP
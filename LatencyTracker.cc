@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+#include "LatencyTracker.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+// RFC 6298's gains for the smoothed RTT and its deviation
+static const double SRTT_GAIN = 0.125;
+static const double RTTVAR_GAIN = 0.25;
+
+// samples kept per server for percentiles
+static const size_t HISTORY = 128;
+
+LatencyTracker::LatencyTracker(const vector<string> &hosts, const vector<int> &ports, uint64_t timeout)
+    : warmed(hosts.size(), 0), estimates(hosts.size(), Estimate{0, 0, 0, deque<double>()}), stopping(false)
+{
+    for (size_t server = 0; server < hosts.size(); ++server)
+    {
+        probes.push_back(unique_ptr<rpc::client>(new rpc::client(hosts[server], ports[server])));
+        probes.back()->set_timeout(timeout);
+    }
+}
+
+LatencyTracker::~LatencyTracker()
+{
+    stop();
+}
+
+void LatencyTracker::stop()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (prober.joinable())
+    {
+        prober.join();
+    }
+}
+
+void LatencyTracker::probe(size_t rounds)
+{
+    vector<thread> probers;
+    for (size_t server = 0; server < probes.size(); ++server)
+    {
+        probers.push_back(thread([this, server, rounds]() {
+            for (size_t round = 0; round < rounds; ++round)
+            {
+                ping(server);
+            }
+        }));
+    }
+    for (thread &t : probers)
+    {
+        t.join();
+    }
+}
+
+void LatencyTracker::start(milliseconds interval)
+{
+    if (!prober.joinable())
+    {
+        prober = thread(&LatencyTracker::probe_stage, this, interval);
+    }
+}
+
+void LatencyTracker::observe(int server, double us)
+{
+    lock_guard<mutex> guard(lock);
+    Estimate &est = estimates[server];
+    if (est.samples++ == 0)
+    {
+        est.srtt = us;
+        est.rttvar = us / 2;
+    }
+    else
+    {
+        est.rttvar = (1 - RTTVAR_GAIN) * est.rttvar + RTTVAR_GAIN * fabs(est.srtt - us);
+        est.srtt = (1 - SRTT_GAIN) * est.srtt + SRTT_GAIN * us;
+    }
+    est.recent.push_back(us);
+    if (est.recent.size() > HISTORY)
+    {
+        est.recent.pop_front();
+    }
+}
+
+double LatencyTracker::srtt_us(int server)
+{
+    lock_guard<mutex> guard(lock);
+    const Estimate &est = estimates[server];
+    return est.samples > 0 ? est.srtt : numeric_limits<double>::max();
+}
+
+double LatencyTracker::jitter_us(int server)
+{
+    lock_guard<mutex> guard(lock);
+    return estimates[server].rttvar;
+}
+
+double LatencyTracker::percentile_us(int server, double p)
+{
+    vector<double> sorted;
+    {
+        lock_guard<mutex> guard(lock);
+        sorted.assign(estimates[server].recent.begin(), estimates[server].recent.end());
+    }
+    if (sorted.empty())
+    {
+        return numeric_limits<double>::max();
+    }
+    sort(sorted.begin(), sorted.end());
+    return sorted[min(sorted.size() - 1, (size_t)(sorted.size() * p / 100))];
+}
+
+vector<int> LatencyTracker::ranking()
+{
+    vector<double> srtt;
+    for (size_t server = 0; server < probes.size(); ++server)
+    {
+        srtt.push_back(srtt_us(server));
+    }
+
+    vector<int> order(probes.size());
+    for (size_t server = 0; server < order.size(); ++server)
+    {
+        order[server] = server;
+    }
+    stable_sort(order.begin(), order.end(), [&](int a, int b) { return srtt[a] < srtt[b]; });
+    return order;
+}
+
+void LatencyTracker::report()
+{
+    auto log = logger();
+
+    for (size_t server = 0; server < probes.size(); ++server)
+    {
+        size_t samples;
+        {
+            lock_guard<mutex> guard(lock);
+            samples = estimates[server].samples;
+        }
+        if (samples == 0)
+        {
+            log->error("RTT of server #{}: no replies", server);
+            continue;
+        }
+        log->error("RTT of server #{}: {:.3f} ms smoothed, {:.3f} ms jitter, p50 {:.3f} ms, p99 {:.3f} ms, {} samples",
+                   server, srtt_us(server) / 1e3, jitter_us(server) / 1e3,
+                   percentile_us(server, 50) / 1e3, percentile_us(server, 99) / 1e3, samples);
+    }
+}
+
+/**
+ * Time one ping() to server; an unreachable server is left without a sample.
+ * Only one thread pings a given server at a time.
+ */
+void LatencyTracker::ping(int server)
+{
+    auto log = logger();
+
+    try
+    {
+        if (!warmed[server])
+        {
+            // connecting takes a round trip or more of its own
+            probes[server]->call("ping");
+            warmed[server] = 1;
+        }
+    }
+    catch (exception &e)
+    {
+        log->info("Ping to server #{} failed: {}", server, e.what());
+        return;
+    }
+
+    auto start = high_resolution_clock::now();
+    try
+    {
+        probes[server]->call("ping");
+    }
+    catch (exception &e)
+    {
+        log->info("Ping to server #{} failed: {}", server, e.what());
+        return;
+    }
+    observe(server, duration_cast<nanoseconds>(high_resolution_clock::now() - start).count() / 1e3);
+}
+
+// the background prober: ping every server at once, every interval
+void LatencyTracker::probe_stage(milliseconds interval)
+{
+    for (;;)
+    {
+        {
+            unique_lock<mutex> guard(lock);
+            if (wake.wait_for(guard, interval, [&]() { return stopping; }))
+            {
+                return;
+            }
+        }
+        probe(1);
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef LATENCYTRACKER_HPP
+#define LATENCYTRACKER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rpc/client.h"
+
+#include "logger.hpp"
+
+using namespace std;
+
+/**
+ * Keeps a running estimate of the round-trip time to every SurfStoreServer.
+ *
+ * probe() times ping() calls to all servers at once, one thread per
+ * server, with microsecond resolution, so startup takes as long as the
+ * slowest server's probes rather than the sum over all servers. start()
+ * keeps probing every server in the background for as long as the tracker
+ * lives, and observe() folds in the latency of the small RPCs the engines
+ * make anyway (has_blocks), so the estimates follow the network, and the
+ * servers' load, as a long run goes on. Batches that carry blocks are not
+ * observed: their time grows with their payload, not with distance.
+ *
+ * Every sample updates a smoothed RTT and its mean deviation, the jitter,
+ * the way TCP does (RFC 6298), and is kept among the server's latest
+ * samples for percentiles. ranking() orders the servers by smoothed RTT,
+ * so callers that re-rank as they go pick replicas by current conditions.
+ *
+ * Pings go over connections of the tracker's own, one per server, rather
+ * than the engines' clients: a ping sent on a connection that is busy
+ * writing a multi-MB batch would queue behind it, and time the payload
+ * instead of the network. The first ping on each connection only sets it up
+ * and is not timed.
+ *
+ * A server that never answered a probe ranks last. Every method may be
+ * called from any thread.
+ */
+class LatencyTracker
+{
+  public:
+    // connect to the server at hosts[i]:ports[i] for every i; pings time out
+    // after timeout milliseconds
+    LatencyTracker(const vector<string> &hosts, const vector<int> &ports, uint64_t timeout);
+    ~LatencyTracker();
+
+    // ping every server rounds times, all servers at once, and wait
+    void probe(size_t rounds);
+
+    // ping every server every interval until stop(), or until the tracker
+    // is destroyed
+    void start(chrono::milliseconds interval);
+    // stop the background prober
+    void stop();
+
+    // fold in a reply from server that took us microseconds
+    void observe(int server, double us);
+
+    double srtt_us(int server);
+    double jitter_us(int server);
+    // the p-th percentile (0 to 100) of server's latest samples
+    double percentile_us(int server, double p);
+
+    // every server, smallest smoothed RTT first
+    vector<int> ranking();
+
+    // log every server's smoothed RTT, jitter and percentiles
+    void report();
+
+  protected:
+    struct Estimate
+    {
+        size_t samples;
+        double srtt;   // microseconds
+        double rttvar; // mean deviation, microseconds
+        deque<double> recent;
+    };
+
+    vector<unique_ptr<rpc::client>> probes;
+    vector<char> warmed; // per server, see ping(); not bits, as probe threads set theirs at once
+
+    mutex lock; // guards everything below
+    vector<Estimate> estimates;
+    bool stopping;
+    condition_variable wake;
+    thread prober;
+
+    void ping(int server);
+    void probe_stage(chrono::milliseconds interval);
+};
+
+#endif // LATENCYTRACKER_HPP
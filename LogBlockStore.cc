@@ -0,0 +1,286 @@
+#include <sysexits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "logger.hpp"
+#include "LogBlockStore.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * On-disk record layout, all integers in host byte order:
+ *
+ *   | magic:u32 | hash_len:u32 | data_len:u32 | codec:u32 | hash bytes | data bytes |
+ *
+ * The magic number lets recovery tell a real record from the zeroes or
+ * garbage left behind by an interrupted append. The hash is 32 raw bytes;
+ * segments written before BlockHash existed hold 64 hex characters, which
+ * recovery accepts too. Records written before blocks could be compressed
+ * have another magic number and no codec field, and hold raw blocks.
+ */
+static const uint32_t RECORD_MAGIC = 0x434c5353;     // "SSLC"
+static const uint32_t RAW_RECORD_MAGIC = 0x424c5353; // "SSLB"
+static const size_t RECORD_HEADER_SIZE = 4 * sizeof(uint32_t);
+static const size_t RAW_RECORD_HEADER_SIZE = 3 * sizeof(uint32_t);
+
+// mkdir -p
+static bool make_dirs(const string &path)
+{
+    size_t pos = 0;
+    while (pos != string::npos)
+    {
+        pos = path.find('/', pos + 1);
+        string prefix = path.substr(0, pos);
+        if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+LogBlockStore::LogBlockStore(string t_data_dir, uint64_t t_segment_size, bool t_sync_writes)
+    : data_dir(t_data_dir), segment_size(t_segment_size), sync_writes(t_sync_writes)
+{
+    auto log = logger();
+
+    if (!make_dirs(data_dir))
+    {
+        log->error("Unable to create data directory {}: {}", data_dir, strerror(errno));
+        exit(EX_CANTCREAT);
+    }
+
+    auto start = high_resolution_clock::now();
+    recover();
+    auto stop = high_resolution_clock::now();
+
+    log->info("Recovered {} blocks from {} segments in {}: {} milliseconds",
+              index.size(), segments.size(), data_dir, duration_cast<milliseconds>(stop - start).count());
+}
+
+LogBlockStore::~LogBlockStore()
+{
+    for (const Segment &seg : segments)
+    {
+        munmap((void *)seg.base, seg.capacity);
+        close(seg.fd);
+    }
+}
+
+string LogBlockStore::segment_path(uint32_t id)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "segment-%06u.log", id);
+    return data_dir + "/" + name;
+}
+
+uint32_t LogBlockStore::open_segment(uint32_t id, uint64_t capacity)
+{
+    auto log = logger();
+
+    int fd = open(segment_path(id).c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        log->error("Unable to open segment {}: {}", segment_path(id), strerror(errno));
+        exit(EX_CANTCREAT);
+    }
+
+    // Map the whole capacity now, even though the file is still short: the
+    // mapping never has to move as the segment grows, so views handed out
+    // earlier stay valid. Only bytes below the file's size are ever read.
+    void *base = mmap(NULL, capacity, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        log->error("Unable to mmap segment {}: {}", segment_path(id), strerror(errno));
+        exit(EX_OSERR);
+    }
+
+    lock_guard<mutex> guard(segments_lock);
+    segments.push_back(Segment{fd, 0, (const char *)base, capacity});
+    return id;
+}
+
+bool LogBlockStore::locate(const BlockHash &hash, BlockView &view)
+{
+    Location loc;
+    if (!index.get(hash, loc))
+    {
+        return false;
+    }
+
+    lock_guard<mutex> guard(segments_lock);
+    view = BlockView{segments[loc.segment].base + loc.offset, loc.length, loc.codec, nullptr};
+    return true;
+}
+
+/**
+ * Rebuild the index from the segments on disk. Segments are numbered
+ * contiguously from 0, so we open them in order until one is missing.
+ */
+void LogBlockStore::recover()
+{
+    for (uint32_t id = 0;; ++id)
+    {
+        struct stat st;
+        if (stat(segment_path(id).c_str(), &st) != 0)
+        {
+            break;
+        }
+        open_segment(id, max(segment_size, (uint64_t)st.st_size));
+        segments[id].size = scan_segment(id, segments[id].fd, (uint64_t)st.st_size);
+    }
+
+    // always have an active segment to append to
+    if (segments.empty())
+    {
+        open_segment(0, segment_size);
+    }
+}
+
+/**
+ * Walk the record headers of one segment and add its blocks to the index.
+ * Returns the length of the valid prefix; anything after it is a torn
+ * append and gets truncated.
+ */
+uint64_t LogBlockStore::scan_segment(uint32_t id, int fd, uint64_t file_size)
+{
+    auto log = logger();
+    uint64_t offset = 0;
+
+    while (offset + RAW_RECORD_HEADER_SIZE <= file_size)
+    {
+        uint32_t header[4] = {0, 0, 0, BlockCodec::NONE};
+        ssize_t n = pread(fd, header, min((uint64_t)RECORD_HEADER_SIZE, file_size - offset), offset);
+        size_t header_size = header[0] == RAW_RECORD_MAGIC ? RAW_RECORD_HEADER_SIZE : RECORD_HEADER_SIZE;
+        if (n < (ssize_t)header_size || (header[0] != RECORD_MAGIC && header[0] != RAW_RECORD_MAGIC))
+        {
+            break;
+        }
+        uint32_t hash_len = header[1], data_len = header[2];
+        if (header_size == RAW_RECORD_HEADER_SIZE)
+        {
+            header[3] = BlockCodec::NONE; // pread read into the next record
+        }
+        uint64_t record_end = offset + header_size + hash_len + data_len;
+        if (record_end > file_size || !BlockCodec::valid(header[3]))
+        {
+            break;
+        }
+
+        string wire(hash_len, '\0');
+        BlockHash hash;
+        if (pread(fd, &wire[0], hash_len, offset + header_size) != (ssize_t)hash_len ||
+            !BlockHash::from_wire(wire, hash))
+        {
+            break;
+        }
+        index.insert(hash, Location{id, offset + header_size + hash_len, data_len, (BlockCodec::Codec)header[3]});
+        offset = record_end;
+    }
+
+    if (offset != file_size)
+    {
+        log->error("Segment {} has a torn record at offset {}; truncating {} bytes",
+                   segment_path(id), offset, file_size - offset);
+        if (ftruncate(fd, offset) != 0)
+        {
+            log->error("Unable to truncate segment {}: {}", segment_path(id), strerror(errno));
+        }
+    }
+
+    return offset;
+}
+
+bool LogBlockStore::store(const BlockHash &hash, const string &data, BlockCodec::Codec codec)
+{
+    auto log = logger();
+
+    lock_guard<mutex> guard(append_lock);
+
+    if (index.contains(hash))
+    {
+        return false;
+    }
+
+    uint64_t record_size = RECORD_HEADER_SIZE + BlockHash::SIZE + data.size();
+
+    // roll over to a fresh segment once the active one is full. A block larger
+    // than segment_size gets a segment (and mapping) of its own.
+    uint32_t id = segments.size() - 1;
+    if (segments[id].size + record_size > segments[id].capacity)
+    {
+        id = open_segment(id + 1, max(segment_size, record_size));
+    }
+    int fd = segments[id].fd;
+    uint64_t offset = segments[id].size;
+
+    uint32_t header[4] = {RECORD_MAGIC, (uint32_t)BlockHash::SIZE, (uint32_t)data.size(), (uint32_t)codec};
+    struct iovec iov[3];
+    iov[0].iov_base = header;
+    iov[0].iov_len = RECORD_HEADER_SIZE;
+    iov[1].iov_base = (void *)hash.bytes;
+    iov[1].iov_len = BlockHash::SIZE;
+    iov[2].iov_base = (void *)data.data();
+    iov[2].iov_len = data.size();
+
+    ssize_t written = pwritev(fd, iov, 3, offset);
+    if (written != (ssize_t)record_size || (sync_writes && fdatasync(fd) != 0))
+    {
+        log->error("Failed appending block {} to {}: {}", hash.hex(), segment_path(id), strerror(errno));
+        // drop the partial record so the next append starts at a clean offset
+        if (ftruncate(fd, offset) != 0)
+        {
+            log->error("Unable to truncate segment {}: {}", segment_path(id), strerror(errno));
+        }
+        return false;
+    }
+
+    {
+        lock_guard<mutex> seg_guard(segments_lock);
+        segments[id].size += record_size;
+    }
+    return index.insert(hash, Location{id, offset + RECORD_HEADER_SIZE + BlockHash::SIZE, (uint32_t)data.size(), codec});
+}
+
+bool LogBlockStore::get(const BlockHash &hash, string &data, BlockCodec::Codec &codec)
+{
+    BlockView view;
+    if (!locate(hash, view))
+    {
+        return false;
+    }
+    data.assign(view.data, view.length);
+    codec = view.codec;
+    return true;
+}
+
+bool LogBlockStore::get_view(const BlockHash &hash, BlockView &view)
+{
+    return locate(hash, view);
+}
+
+bool LogBlockStore::contains(const BlockHash &hash)
+{
+    return index.contains(hash);
+}
+
+list<BlockHash> LogBlockStore::hashes()
+{
+    return index.keys();
+}
+
+size_t LogBlockStore::size()
+{
+    return index.size();
+}
@@ -0,0 +1,82 @@
+#ifndef LOGBLOCKSTORE_HPP
+#define LOGBLOCKSTORE_HPP
+
+#include <stdint.h>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BlockHash.hpp"
+#include "BlockStore.hpp"
+#include "ShardedMap.hpp"
+
+using namespace std;
+
+/**
+ * A persistent, log-structured block engine.
+ *
+ * Blocks are appended to numbered segment files (segment-000000.log, ...)
+ * under data_dir; a segment is sealed once it reaches segment_size bytes and
+ * a new one is started. Each record is a small fixed header (which includes
+ * the block's codec) followed by the raw 32-byte hash and the block payload.
+ * Only the hash -> (segment, offset, length) index lives in memory, so
+ * capacity is bounded by disk, not RAM.
+ *
+ * Every segment is mmap'd read-only for its full capacity up front (pages
+ * past the end of the file are never touched), so reads are served straight
+ * out of the page cache: get_view() hands out a pointer into the mapping and
+ * get() is a single memcpy.
+ *
+ * On startup the index is rebuilt by scanning every segment's record
+ * headers (the payloads are skipped, not read). A torn record at the tail of
+ * the last segment, e.g. from a crash in the middle of an append, is
+ * truncated away.
+ */
+class LogBlockStore : public BlockStore
+{
+  public:
+    LogBlockStore(string t_data_dir, uint64_t t_segment_size, bool t_sync_writes);
+    ~LogBlockStore();
+
+    bool store(const BlockHash &hash, const string &data, BlockCodec::Codec codec);
+    bool get(const BlockHash &hash, string &data, BlockCodec::Codec &codec);
+    bool get_view(const BlockHash &hash, BlockView &view);
+    bool contains(const BlockHash &hash);
+    list<BlockHash> hashes();
+    size_t size();
+
+  protected:
+    struct Location
+    {
+        uint32_t segment;
+        uint64_t offset; // offset of the payload (not the record header) in the segment
+        uint32_t length;
+        BlockCodec::Codec codec;
+    };
+
+    struct Segment
+    {
+        int fd;
+        uint64_t size;     // bytes of valid records
+        const char *base;  // read-only mapping of the segment
+        uint64_t capacity; // length of the mapping; records never cross it
+    };
+
+    string data_dir;
+    uint64_t segment_size; // roll over to a new segment past this many bytes
+    bool sync_writes;      // fdatasync() every record before acknowledging it
+
+    mutex append_lock;             // serializes appends to the active (last) segment
+    mutable mutex segments_lock;   // guards the segments vector itself
+    vector<Segment> segments;
+    ShardedMap<BlockHash, Location> index;
+
+    string segment_path(uint32_t id);
+    uint32_t open_segment(uint32_t id, uint64_t capacity); // returns the new segment's id
+    void recover();
+    uint64_t scan_segment(uint32_t id, int fd, uint64_t file_size);
+    bool locate(const BlockHash &hash, BlockView &view);
+};
+
+#endif // LOGBLOCKSTORE_HPP
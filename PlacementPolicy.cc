@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <future>
+#include <tuple>
+
+#include "logger.hpp"
+#include "SurfStoreTypes.hpp"
+#include "PlacementPolicy.hpp"
+
+using namespace std;
+
+bool PlacementPolicy::known(const string &name)
+{
+    return name == RAND || name == TWO_RAND || name == LOCAL || name == LOCAL_CLOSE || name == LOCAL_FAR ||
+           name == TWO_CHOICES || name == ERASURE || name == RENDEZVOUS;
+}
+
+PlacementPolicy *PlacementPolicy::create(const string &name, vector<rpc::client *> &clients, const vector<string> &addresses,
+                                         LatencyTracker &latency, int protocol, int replicas, const ErasureCode &code)
+{
+    int num_servers = (int)clients.size();
+    if (name == RAND)
+    {
+        return new RandomPolicy(num_servers, 1);
+    }
+    if (name == TWO_RAND)
+    {
+        return new RandomPolicy(num_servers, 2);
+    }
+    if (name == LOCAL)
+    {
+        return new LocalPolicy(latency, LocalPolicy::NONE);
+    }
+    if (name == LOCAL_CLOSE)
+    {
+        return new LocalPolicy(latency, LocalPolicy::CLOSEST);
+    }
+    if (name == LOCAL_FAR)
+    {
+        return new LocalPolicy(latency, LocalPolicy::FARTHEST);
+    }
+    if (name == TWO_CHOICES)
+    {
+        return new TwoChoicesPolicy(clients, latency, protocol, replicas);
+    }
+    if (name == ERASURE)
+    {
+        return new ErasurePolicy(num_servers, code);
+    }
+    if (name == RENDEZVOUS)
+    {
+        return new RendezvousPolicy(addresses, replicas);
+    }
+    return nullptr;
+}
+
+// a server not in chosen, picked at random; chosen must leave one out
+static int random_other(int num_servers, const vector<int> &chosen)
+{
+    int server;
+    do
+    {
+        server = rand() % num_servers;
+    } while (find(chosen.begin(), chosen.end(), server) != chosen.end());
+    return server;
+}
+
+RandomPolicy::RandomPolicy(int t_num_servers, int t_copies)
+    : num_servers(t_num_servers), copies(min(t_copies, t_num_servers))
+{
+}
+
+/**
+ * For the random policy, when a client uploads a file to the cloud, it simply
+ * chooses, for each block, a random datacenter and stores the block there.
+ * For tworandom, the client chooses two datacenters at random for each block,
+ * and makes sure that they are two different ones.
+ */
+vector<int> RandomPolicy::place(const BlockHash &, size_t)
+{
+    vector<int> targets;
+    while ((int)targets.size() < copies)
+    {
+        targets.push_back(random_other(num_servers, targets));
+    }
+    return targets;
+}
+
+LocalPolicy::LocalPolicy(LatencyTracker &t_latency, Partner t_partner)
+    : latency(t_latency), partner(t_partner), local_idx(t_latency.ranking()[0]), partner_idx(-1)
+{
+    refresh();
+}
+
+/**
+ * The local server is the one with the smallest RTT (don't check if it is
+ * equal to zero because it might be non-zero, but close to zero, due to
+ * protocol overhead). localclosest pairs it with whichever other datacenter
+ * has the smallest RTT, localfarthest with the one that has the highest,
+ * i.e. is likely farthest away.
+ */
+vector<int> LocalPolicy::place(const BlockHash &, size_t)
+{
+    vector<int> targets(1, local_idx);
+    if (partner != NONE && partner_idx != local_idx)
+    {
+        targets.push_back(partner_idx);
+    }
+    return targets;
+}
+
+void LocalPolicy::refresh()
+{
+    vector<int> order = latency.ranking();
+    order.erase(find(order.begin(), order.end(), local_idx));
+
+    // with a single server, the block is only stored once
+    partner_idx = order.empty() ? local_idx : partner == CLOSEST ? order.front() : order.back();
+}
+
+TwoChoicesPolicy::TwoChoicesPolicy(vector<rpc::client *> &t_clients, LatencyTracker &t_latency, int t_protocol, int t_copies)
+    : clients(t_clients), latency(t_latency), protocol(t_protocol), copies(min(t_copies, (int)t_clients.size())),
+      srtt(t_clients.size(), 0), bytes(t_clients.size(), 0), in_flight(t_clients.size(), 0)
+{
+    refresh();
+}
+
+vector<int> TwoChoicesPolicy::place(const BlockHash &, size_t length)
+{
+    int num_servers = (int)clients.size();
+    double mean_bytes = 0;
+    for (uint64_t b : bytes)
+    {
+        mean_bytes += b;
+    }
+    mean_bytes /= num_servers;
+
+    vector<int> targets;
+    while ((int)targets.size() < copies)
+    {
+        int first = random_other(num_servers, targets);
+        int pick = first;
+        if (num_servers - (int)targets.size() > 1)
+        {
+            targets.push_back(first);
+            int second = random_other(num_servers, targets);
+            targets.pop_back();
+            pick = cost(second, mean_bytes) < cost(first, mean_bytes) ? second : first;
+        }
+        targets.push_back(pick);
+        bytes[pick] += length;
+    }
+    return targets;
+}
+
+/**
+ * Take in the current RTTs and ask every server, all at once, for its load.
+ * A server that does not answer keeps the load it had.
+ */
+void TwoChoicesPolicy::refresh()
+{
+    auto log = logger();
+
+    for (size_t server = 0; server < clients.size(); ++server)
+    {
+        srtt[server] = latency.srtt_us(server);
+    }
+    if (protocol < 5)
+    {
+        return;
+    }
+
+    vector<future<RPCLIB_MSGPACK::object_handle>> replies;
+    for (size_t server = 0; server < clients.size(); ++server)
+    {
+        replies.push_back(clients[server]->async_call("get_load"));
+    }
+    for (size_t server = 0; server < clients.size(); ++server)
+    {
+        try
+        {
+            auto load = replies[server].get().as<tuple<uint64_t, uint64_t>>();
+            bytes[server] = get<0>(load);
+            in_flight[server] = get<1>(load);
+        }
+        catch (exception &e)
+        {
+            log->error("get_load from server #{} failed: {}", server, e.what());
+        }
+    }
+}
+
+double TwoChoicesPolicy::cost(int server, double mean_bytes)
+{
+    // never zero, so that the other factors still count
+    double rtt = max(srtt[server], 1.0);
+    double fullness = (bytes[server] + 1.0) / (mean_bytes + 1.0);
+    return rtt * (1 + in_flight[server]) * fullness;
+}
+
+ErasurePolicy::ErasurePolicy(int t_num_servers, const ErasureCode &t_code)
+    : num_servers(t_num_servers), code(t_code)
+{
+}
+
+vector<int> ErasurePolicy::place(const BlockHash &hash, size_t)
+{
+    int first = hash.bytes[0] % num_servers;
+    vector<int> targets;
+    for (int index = 0; index < code.fragments(); ++index)
+    {
+        targets.push_back((first + index) % num_servers);
+    }
+    return targets;
+}
+
+bool ErasurePolicy::split(const BlockHash &hash, BlockCodec::Codec codec, const string &block, vector<Fragment> &out)
+{
+    code.encode(block, codec, scratch);
+    vector<int> targets = place(hash, block.size());
+
+    // the buffers of out's last fragments are swapped into scratch, so that
+    // a caller that keeps passing the same out never allocates
+    out.resize(code.fragments());
+    for (int index = 0; index < code.fragments(); ++index)
+    {
+        out[index].server = targets[index];
+        out[index].hash = ErasureCode::fragment_hash(hash, index);
+        out[index].data.swap(scratch[index]);
+    }
+    return true;
+}
+
+// splitmix64's finalizer
+static uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+RendezvousPolicy::RendezvousPolicy(const vector<string> &addresses, int t_copies)
+    : copies(min(t_copies, (int)addresses.size()))
+{
+    // FNV-1a of the address
+    for (const string &address : addresses)
+    {
+        uint64_t key = 0xcbf29ce484222325ULL;
+        for (char c : address)
+        {
+            key = (key ^ (uint8_t)c) * 0x100000001b3ULL;
+        }
+        keys.push_back(key);
+    }
+}
+
+vector<int> RendezvousPolicy::place(const BlockHash &hash, size_t)
+{
+    vector<int> order = rank(hash);
+    order.resize(copies);
+    return order;
+}
+
+vector<int> RendezvousPolicy::rank(const BlockHash &hash) const
+{
+    // bytes 8 to 15, as the first 8 already pick fingerprints and fragment
+    // servers
+    uint64_t block = 0;
+    for (size_t i = 8; i < 16; ++i)
+    {
+        block = block << 8 | hash.bytes[i];
+    }
+
+    vector<uint64_t> weight;
+    vector<int> order;
+    for (size_t server = 0; server < keys.size(); ++server)
+    {
+        weight.push_back(mix(block ^ keys[server]));
+        order.push_back(server);
+    }
+    sort(order.begin(), order.end(), [&](int a, int b) { return weight[a] > weight[b]; });
+    return order;
+}
@@ -0,0 +1,198 @@
+#ifndef PLACEMENTPOLICY_HPP
+#define PLACEMENTPOLICY_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "rpc/client.h"
+
+#include "BlockCodec.hpp"
+#include "BlockHash.hpp"
+#include "ErasureCode.hpp"
+#include "LatencyTracker.hpp"
+
+using namespace std;
+
+/**
+ * Decides which servers an uploaded block is stored on.
+ *
+ * The uploader asks its policy for the targets of every block and hands the
+ * block to the UploadEngine once per target; a policy never names a server
+ * twice for the same block. A policy may instead split() a block into
+ * fragments, each with a server and a key of its own. refresh() is called
+ * before every file, so policies that go by RTT or load can take in what
+ * changed since the last file. A new policy subclasses PlacementPolicy and
+ * gets a name in create().
+ */
+class PlacementPolicy
+{
+  public:
+    // a piece of a block, stored on server under hash
+    struct Fragment
+    {
+        int server;
+        BlockHash hash;
+        string data;
+    };
+
+    virtual ~PlacementPolicy() {}
+
+    // the servers to store a block of length bytes with this hash on
+    virtual vector<int> place(const BlockHash &hash, size_t length) = 0;
+
+    // for policies that store pieces of a block rather than copies: fill
+    // out with the pieces of block, stored with codec, and return true
+    virtual bool split(const BlockHash &, BlockCodec::Codec, const string &, vector<Fragment> &) { return false; }
+
+    virtual void refresh() {}
+
+    // whether create() knows the policy called name
+    static bool known(const string &name);
+
+    // the policy called name, see SurfStoreTypes.hpp, or nullptr. addresses
+    // holds every server's "host:port", replicas is the number of copies for
+    // policies that do not fix it themselves, code the erasure code for the
+    // erasure policy.
+    static PlacementPolicy *create(const string &name, vector<rpc::client *> &clients, const vector<string> &addresses,
+                                   LatencyTracker &latency, int protocol, int replicas, const ErasureCode &code);
+};
+
+/**
+ * random: one copy on a random server. tworandom: two copies on two
+ * different random servers.
+ */
+class RandomPolicy : public PlacementPolicy
+{
+  public:
+    RandomPolicy(int t_num_servers, int t_copies);
+
+    vector<int> place(const BlockHash &hash, size_t length);
+
+  protected:
+    int num_servers;
+    int copies;
+};
+
+/**
+ * local: one copy on the local server, the closest one when the policy is
+ * made, which is taken to be in our datacenter for the rest of the run.
+ * localclosest and localfarthest add a second copy on the closest, or the
+ * farthest, other server, picked again on every refresh().
+ */
+class LocalPolicy : public PlacementPolicy
+{
+  public:
+    enum Partner
+    {
+        NONE,
+        CLOSEST,
+        FARTHEST,
+    };
+
+    LocalPolicy(LatencyTracker &t_latency, Partner t_partner);
+
+    vector<int> place(const BlockHash &hash, size_t length);
+    void refresh();
+
+  protected:
+    LatencyTracker &latency;
+    Partner partner;
+    int local_idx;
+    int partner_idx;
+};
+
+/**
+ * twochoices: every copy goes to the cheaper of two different random
+ * servers not already holding a copy ("the power of two choices",
+ * Mitzenmacher, 2001).
+ *
+ * A server's cost is the time it would take to take one more block: its
+ * smoothed RTT, times one plus the block RPCs it was serving for any
+ * client at the last refresh(), times how full it is relative to the
+ * average server. Fullness counts the bytes it reported storing at the
+ * last refresh(), plus the bytes this policy has sent its way since.
+ * Sampling two servers rather than taking the cheapest of all keeps a
+ * burst of uploads from piling onto one server between refreshes, and
+ * costs two lookups however many servers there are.
+ *
+ * Loads come from get_load (protocol version 5); with older servers, only
+ * the bytes placed in this run count.
+ */
+class TwoChoicesPolicy : public PlacementPolicy
+{
+  public:
+    TwoChoicesPolicy(vector<rpc::client *> &t_clients, LatencyTracker &t_latency, int t_protocol, int t_copies);
+
+    vector<int> place(const BlockHash &hash, size_t length);
+    void refresh();
+
+  protected:
+    vector<rpc::client *> &clients;
+    LatencyTracker &latency;
+    int protocol;
+    int copies;
+
+    vector<double> srtt;        // microseconds, as of the last refresh()
+    vector<uint64_t> bytes;     // stored as of the last refresh(), plus placed since
+    vector<uint64_t> in_flight; // block RPCs the server was serving at the last refresh()
+
+    double cost(int server, double mean_bytes);
+};
+
+/**
+ * erasure: every block is cut into data() + parity() fragments with a
+ * Reed-Solomon code, see ErasureCode.hpp, fragment i going to server
+ * (first + i) mod num_servers, where first comes from the block hash so
+ * that fragments spread evenly. With no more fragments than servers, any
+ * parity() servers may be lost, for (data() + parity()) / data() times the
+ * block's size in uploads and storage.
+ *
+ * Fragments are stored under ErasureCode::fragment_hash() keys, which the
+ * downloader derives from the file's hash list in turn.
+ */
+class ErasurePolicy : public PlacementPolicy
+{
+  public:
+    ErasurePolicy(int t_num_servers, const ErasureCode &t_code);
+
+    // the server of every fragment, in order
+    vector<int> place(const BlockHash &hash, size_t length);
+    bool split(const BlockHash &hash, BlockCodec::Codec codec, const string &block, vector<Fragment> &out);
+
+  protected:
+    int num_servers;
+    const ErasureCode &code;
+    vector<string> scratch; // fragment buffers, reused from block to block
+};
+
+/**
+ * rendezvous: replicas copies on the servers that rank highest for the
+ * block, each server's rank being a hash of the block hash and the server's
+ * address ("highest random weight" hashing, Thaler and Ravishankar, 1998).
+ * Anyone with the block hash and the [ssd] section can work out where a
+ * block is, so the downloader needs no inventory of the servers.
+ *
+ * Servers are told apart by address, not position, so adding a server to
+ * [ssd] only moves the blocks for which it ranks among the top replicas,
+ * about replicas / num_servers of them, and every block's old holders are
+ * still the next ones in its rank(). Removing a server only moves the
+ * blocks it held.
+ */
+class RendezvousPolicy : public PlacementPolicy
+{
+  public:
+    RendezvousPolicy(const vector<string> &addresses, int t_copies);
+
+    vector<int> place(const BlockHash &hash, size_t length);
+
+    // every server, from the highest rank for the block with hash down
+    vector<int> rank(const BlockHash &hash) const;
+
+  protected:
+    vector<uint64_t> keys; // per server: a hash of its address
+    int copies;
+};
+
+#endif // PLACEMENTPOLICY_HPP
@@ -0,0 +1,38 @@
+#include <sysexits.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "rpc/rpc_error.h"
+
+#include "logger.hpp"
+#include "Protocol.hpp"
+
+using namespace std;
+
+int negotiate_protocol(vector<rpc::client *> &clients)
+{
+    auto log = logger();
+
+    int protocol = PROTOCOL_VERSION;
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        int version;
+        try
+        {
+            version = clients[i]->call("get_protocol_version").as<int>();
+        }
+        catch (rpc::rpc_error &)
+        {
+            // "function not found": a server that only has the per-block RPCs
+            log->error("Server #{} predates protocol version 2, which is needed", i);
+            exit(EX_PROTOCOL);
+        }
+        log->info("Server #{} speaks protocol version {}", i, version);
+        protocol = min(protocol, version);
+    }
+
+    log->info("Using protocol version {}", protocol);
+    return protocol;
+}
@@ -0,0 +1,18 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <string>
+#include <vector>
+
+#include "rpc/client.h"
+
+#include "SurfStoreTypes.hpp"
+
+using namespace std;
+
+// the newest protocol version every one of the servers speaks, at most
+// PROTOCOL_VERSION. The clients need the batched, raw-hash RPCs of version
+// 2, so a server that predates get_protocol_version ends the run.
+int negotiate_protocol(vector<rpc::client *> &clients);
+
+#endif // PROTOCOL_HPP
@@ -0,0 +1,501 @@
+#include <sysexits.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+#include "logger.hpp"
+#include "Repairer.hpp"
+#include "ErasureCode.hpp"
+#include "PlacementPolicy.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+// how often progress is logged, and a busy source is asked again
+static const seconds REPORT_INTERVAL(5);
+static const milliseconds BUSY_WAIT(20);
+
+Repairer::Repairer(INIReader &t_config)
+    : config(t_config)
+{
+    auto log = logger();
+
+    // Read in the uploader's block size and placement policy, which decide
+    // batch sizes and where copies go
+    blocksize = (int)config.GetInteger("uploader", "blocksize", -1);
+    if (blocksize <= 0)
+    {
+        log->error("Invalid block size: {}", blocksize);
+        exit(EX_CONFIG);
+    }
+    policy = config.Get("uploader", "policy", "");
+
+    // Read in how many copies every block should have; the uploader's
+    // unless set here
+    replicas = (int)config.GetInteger("repairer", "replicas", config.GetInteger("uploader", "replicas", 2));
+    if (replicas <= 0)
+    {
+        log->error("Invalid number of replicas: {}", replicas);
+        exit(EX_CONFIG);
+    }
+    log->info("Keeping {} copies of every block", replicas);
+
+    // Read in how fast, and in what batches, copies may go out, and how
+    // busy a server may be before it is left alone
+    rate_limit_mb = config.GetReal("repairer", "rate_limit_mb", 10);
+    if (rate_limit_mb <= 0)
+    {
+        log->error("Invalid repair rate: {}", rate_limit_mb);
+        exit(EX_CONFIG);
+    }
+    long batch = config.GetInteger("repairer", "batch_bytes", 8 * (long)blocksize);
+    if (batch <= 0)
+    {
+        log->error("Invalid batch size: {}", batch);
+        exit(EX_CONFIG);
+    }
+    batch_bytes = (size_t)batch;
+    max_busy = (int)config.GetInteger("repairer", "max_busy", 4);
+    if (max_busy < 0)
+    {
+        log->error("Invalid number of busy RPCs: {}", max_busy);
+        exit(EX_CONFIG);
+    }
+    log->info("Copying at most {} MB/s in batches of {} bytes, while servers serve at most {} block RPCs",
+              rate_limit_mb, batch_bytes, max_busy);
+
+    // Read in how often to repair; once by default
+    interval_s = config.GetInteger("repairer", "interval_s", 0);
+    if (interval_s < 0)
+    {
+        log->error("Invalid repair interval: {}", interval_s);
+        exit(EX_CONFIG);
+    }
+
+    num_servers = (int)config.GetInteger("ssd", "num_servers", -1);
+    if (num_servers <= 0)
+    {
+        log->error("num_servers {} is invalid", num_servers);
+        exit(EX_CONFIG);
+    }
+    log->info("Number of servers: {}", num_servers);
+
+    for (int i = 0; i < num_servers; ++i)
+    {
+        string servconf = config.Get("ssd", "server" + std::to_string(i), "");
+        if (servconf == "")
+        {
+            log->error("Server {} not found in config file", i);
+            exit(EX_CONFIG);
+        }
+        size_t idx = servconf.find(":");
+        if (idx == string::npos)
+        {
+            log->error("Config line {} is invalid", servconf);
+            exit(EX_CONFIG);
+        }
+        string host = servconf.substr(0, idx);
+        int port = (int)strtol(servconf.substr(idx + 1).c_str(), nullptr, 0);
+        if (port <= 0 || port > 65535)
+        {
+            log->error("Invalid port number: {}", servconf);
+            exit(EX_CONFIG);
+        }
+
+        log->info("  Server {}= {}:{}", i, host, port);
+        ssdhosts.push_back(host);
+        ssdports.push_back(port);
+    }
+
+    log->info("Repairer initalized");
+}
+
+void Repairer::repair()
+{
+    vector<Server> servers(num_servers);
+    for (Server &server : servers)
+    {
+        server.live = false;
+        server.epoch = 0;
+        server.next_seq = 0;
+        server.stored_bytes = 0;
+    }
+
+    for (;;)
+    {
+        pass(servers);
+        if (interval_s == 0)
+        {
+            break;
+        }
+        this_thread::sleep_for(seconds(interval_s));
+    }
+}
+
+void Repairer::pass(vector<Server> &servers)
+{
+    connect(servers);
+    sync(servers);
+
+    vector<vector<Copy>> copies(num_servers);
+    if (!plan(servers, copies))
+    {
+        return;
+    }
+    copy(servers, copies);
+    wait_forwarded(servers);
+}
+
+/**
+ * Find out which servers are up. A server that was down gets a new
+ * connection; one that cannot copy blocks (before protocol version 7)
+ * counts as down.
+ */
+void Repairer::connect(vector<Server> &servers)
+{
+    auto log = logger();
+
+    for (int i = 0; i < num_servers; ++i)
+    {
+        Server &server = servers[i];
+        bool was_live = server.live;
+        server.live = false;
+        try
+        {
+            if (!was_live)
+            {
+                server.client.reset(new rpc::client(ssdhosts[i], ssdports[i]));
+                server.client->set_timeout(RPC_TIMEOUT);
+            }
+            int version = server.client->call("get_protocol_version").as<int>();
+            if (version < 7)
+            {
+                log->error("Server #{} speaks protocol version {}, repairs need 7; leaving it out", i, version);
+                continue;
+            }
+            server.stored_bytes = get<0>(server.client->call("get_load").as<tuple<uint64_t, uint64_t>>());
+            server.live = true;
+        }
+        catch (exception &e)
+        {
+            log->error("Server #{} is down: {}", i, e.what());
+        }
+    }
+}
+
+// bring our digest of every live server's blocks up to date, as the downloader does
+void Repairer::sync(vector<Server> &servers)
+{
+    auto log = logger();
+
+    for (int i = 0; i < num_servers; ++i)
+    {
+        Server &server = servers[i];
+        if (!server.live)
+        {
+            continue;
+        }
+        try
+        {
+            auto delta = server.client->call("get_blocks_since", server.epoch, server.next_seq)
+                             .as<tuple<uint64_t, uint64_t, string>>();
+            if (get<0>(delta) != server.epoch)
+            {
+                // the server restarted (or we never saw it): start over
+                server.digest.clear();
+                server.epoch = get<0>(delta);
+            }
+            server.digest.add(get<2>(delta));
+            server.next_seq = get<1>(delta);
+            log->info("Server #{} holds {} blocks", i, server.digest.size());
+        }
+        catch (exception &e)
+        {
+            log->error("Syncing the inventory of server #{} failed: {}", i, e.what());
+            server.live = false;
+        }
+    }
+}
+
+/**
+ * List, per source server, the blocks to copy and where to. Returns false
+ * if there is nothing to do.
+ */
+bool Repairer::plan(vector<Server> &servers, vector<vector<Copy>> &copies)
+{
+    auto log = logger();
+
+    vector<int> live;
+    vector<string> addresses;
+    for (int i = 0; i < num_servers; ++i)
+    {
+        if (servers[i].live)
+        {
+            live.push_back(i);
+        }
+        addresses.push_back(ssdhosts[i] + ":" + std::to_string(ssdports[i]));
+    }
+    if (live.empty())
+    {
+        log->error("No server is up, nothing to repair");
+        return false;
+    }
+
+    // every block of every file, as any live server knows them
+    unordered_set<BlockHash> referenced;
+    size_t files = 0;
+    for (int i : live)
+    {
+        try
+        {
+            auto fim = servers[i].client->call("get_fileinfo_map_v2").as<PackedFileInfoMap>();
+            files = max(files, fim.size());
+            for (auto const &entry : fim)
+            {
+                for (const BlockHash &hash : BlockHash::unpack(get<1>(entry.second)))
+                {
+                    referenced.insert(hash);
+                }
+            }
+        }
+        catch (exception &e)
+        {
+            log->error("Getting the FileInfoMap of server #{} failed: {}", i, e.what());
+        }
+    }
+
+    // copies that would not fit on the live servers are not asked for
+    size_t want = min((size_t)replicas, live.size());
+    int fragments = (int)(config.GetInteger("uploader", "erasure_data", 2) + config.GetInteger("uploader", "erasure_parity", 1));
+    unique_ptr<RendezvousPolicy> rendezvous;
+    if (policy == RENDEZVOUS)
+    {
+        rendezvous.reset(new RendezvousPolicy(addresses, replicas));
+    }
+
+    vector<uint64_t> source_bytes(num_servers, 0);
+    size_t under = 0, lost = 0, fragmented = 0;
+    for (const BlockHash &hash : referenced)
+    {
+        if (hash == EMPTY_BLOCK_HASH)
+        {
+            continue;
+        }
+        vector<int> holders;
+        for (int i : live)
+        {
+            if (servers[i].digest.may_contain(hash))
+            {
+                holders.push_back(i);
+            }
+        }
+        if (holders.size() >= want)
+        {
+            continue;
+        }
+
+        if (holders.empty())
+        {
+            bool found = false;
+            for (int index = 0; index < fragments && !found; ++index)
+            {
+                for (int i : live)
+                {
+                    found = found || servers[i].digest.may_contain(ErasureCode::fragment_hash(hash, index));
+                }
+            }
+            if (found)
+            {
+                ++fragmented;
+                continue;
+            }
+            log->error("Block with hash {} is not held by any live server", hash.hex());
+            ++lost;
+            continue;
+        }
+
+        // where the copies go: the next servers in the block's rank, or the
+        // emptiest ones
+        vector<int> candidates = live;
+        if (rendezvous)
+        {
+            candidates = rendezvous->rank(hash);
+        }
+        else
+        {
+            stable_sort(candidates.begin(), candidates.end(),
+                        [&](int a, int b) { return servers[a].stored_bytes < servers[b].stored_bytes; });
+        }
+        Copy copy{hash, vector<int>()};
+        for (int server : candidates)
+        {
+            if (copy.chain.size() + holders.size() < want && servers[server].live &&
+                find(holders.begin(), holders.end(), server) == holders.end())
+            {
+                copy.chain.push_back(server);
+                servers[server].stored_bytes += blocksize;
+            }
+        }
+
+        // spread the sending over the holders
+        int source = *min_element(holders.begin(), holders.end(),
+                                  [&](int a, int b) { return source_bytes[a] < source_bytes[b]; });
+        source_bytes[source] += blocksize * copy.chain.size();
+        copies[source].push_back(copy);
+        ++under;
+    }
+
+    log->error("Repair pass over {} blocks of {} files on {} of {} servers: {} blocks under-replicated, "
+               "{} lost, {} stored as erasure fragments",
+               referenced.size(), files, live.size(), num_servers, under, lost, fragmented);
+    return under > 0;
+}
+
+/**
+ * Have the sources send their copies, a batch at a time, going round the
+ * sources so that they all make progress, and pacing the batches to
+ * rate_limit_mb.
+ */
+void Repairer::copy(vector<Server> &servers, vector<vector<Copy>> &copies)
+{
+    auto log = logger();
+
+    size_t backlog = 0;
+    for (const vector<Copy> &list : copies)
+    {
+        backlog += list.size();
+    }
+    size_t batch_blocks = max((size_t)1, batch_bytes / blocksize);
+
+    size_t copied = 0, missing = 0;
+    double moved = 0; // bytes sent from server to server
+    auto start = steady_clock::now();
+    auto last_report = start;
+    vector<size_t> next(num_servers, 0);
+    bool more = true;
+    while (more)
+    {
+        more = false;
+        for (int source = 0; source < num_servers; ++source)
+        {
+            vector<Copy> &list = copies[source];
+            if (next[source] >= list.size())
+            {
+                continue;
+            }
+            more = true;
+
+            size_t first = next[source];
+            size_t end = min(first + batch_blocks, list.size());
+            next[source] = end;
+            vector<string> hashes;
+            vector<vector<int>> chains;
+            for (size_t k = first; k < end; ++k)
+            {
+                hashes.push_back(list[k].hash.raw());
+                chains.push_back(list[k].chain);
+            }
+
+            vector<uint64_t> sizes;
+            try
+            {
+                // foreground requests go first
+                while (get<1>(servers[source].client->call("get_load").as<tuple<uint64_t, uint64_t>>()) > (uint64_t)max_busy)
+                {
+                    this_thread::sleep_for(BUSY_WAIT);
+                }
+                sizes = servers[source].client->call("copy_blocks", hashes, chains).as<vector<uint64_t>>();
+            }
+            catch (exception &e)
+            {
+                log->error("Copying from server #{} failed, skipping its {} other blocks: {}",
+                           source, list.size() - first, e.what());
+                servers[source].live = false;
+                missing += list.size() - first;
+                next[source] = list.size();
+                continue;
+            }
+
+            for (size_t k = first; k < end; ++k)
+            {
+                uint64_t size = k - first < sizes.size() ? sizes[k - first] : 0;
+                if (size == 0)
+                {
+                    // a digest false positive: the source does not hold it after all
+                    log->info("Server #{} does not hold block with hash {}", source, list[k].hash.hex());
+                    ++missing;
+                    continue;
+                }
+                moved += (double)size * list[k].chain.size();
+                ++copied;
+            }
+
+            // the copies so far may not take less than moved / rate_limit_mb
+            double elapsed = duration_cast<microseconds>(steady_clock::now() - start).count() / 1e6;
+            double ahead = moved / (rate_limit_mb * 1e6) - elapsed;
+            if (ahead > 0)
+            {
+                this_thread::sleep_for(microseconds((long)(ahead * 1e6)));
+            }
+
+            if (steady_clock::now() - last_report >= REPORT_INTERVAL)
+            {
+                last_report = steady_clock::now();
+                double secs = duration_cast<microseconds>(last_report - start).count() / 1e6;
+                log->error("Repair: {} of {} blocks copied, {:.1f} MB at {:.2f} MB/s, {} blocks left",
+                           copied, backlog, moved / 1e6, moved / 1e6 / secs, backlog - copied - missing);
+            }
+        }
+    }
+
+    double secs = duration_cast<microseconds>(steady_clock::now() - start).count() / 1e6;
+    log->error("Repair: {} of {} blocks handed to their sources, {:.1f} MB at {:.2f} MB/s; {} could not be sent",
+               copied, backlog, moved / 1e6, secs > 0 ? moved / 1e6 / secs : 0.0, missing);
+}
+
+// wait until the servers have passed on every copy they were handed
+void Repairer::wait_forwarded(vector<Server> &servers)
+{
+    auto log = logger();
+
+    auto last_report = steady_clock::now();
+    for (;;)
+    {
+        uint64_t backlog = 0, failed = 0;
+        for (int i = 0; i < num_servers; ++i)
+        {
+            if (!servers[i].live)
+            {
+                continue;
+            }
+            try
+            {
+                auto stats = servers[i].client->call("get_forward_stats").as<tuple<uint64_t, uint64_t, uint64_t>>();
+                backlog += get<0>(stats);
+                failed += get<2>(stats);
+            }
+            catch (exception &e)
+            {
+                log->error("Getting the forwarding stats of server #{} failed: {}", i, e.what());
+                servers[i].live = false;
+            }
+        }
+
+        if (backlog == 0)
+        {
+            log->error("Repair pass done; {} blocks failed to forward since the servers started", failed);
+            return;
+        }
+        if (steady_clock::now() - last_report >= REPORT_INTERVAL)
+        {
+            last_report = steady_clock::now();
+            log->error("Repair: {:.1f} MB still to be forwarded by the servers", backlog / 1e6);
+        }
+        this_thread::sleep_for(milliseconds(100));
+    }
+}
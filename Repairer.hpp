@@ -0,0 +1,91 @@
+#ifndef REPAIRER_HPP
+#define REPAIRER_HPP
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "inih/INIReader.h"
+#include "rpc/client.h"
+
+#include "SurfStoreTypes.hpp"
+#include "BlockDigest.hpp"
+#include "logger.hpp"
+
+using namespace std;
+
+/**
+ * Puts back the copies of blocks lost with a server.
+ *
+ * A repair pass syncs the block inventory of every server that answers,
+ * the way the downloader does, and collects the block hashes of every file
+ * in their FileInfo maps. A block held by fewer than replicas of the live
+ * servers gets copies on as many others: the servers rendezvous ranks next
+ * for it with that policy, otherwise the ones storing the fewest bytes. A
+ * server holding it sends it to them itself with copy_blocks (protocol
+ * version 7), down a chain, so repair traffic never crosses the repairer's
+ * own link.
+ *
+ * Copies go out in batches of batch_bytes, paced to at most rate_limit_mb
+ * MB/s across all servers. Before each batch the repairer waits until its
+ * source is serving at most max_busy block RPCs, so foreground get_blocks
+ * keep their latency. Progress and the backlog are logged as the pass goes,
+ * and once the servers' forwarders have drained.
+ *
+ * Blocks no live server holds cannot be copied and are only reported, as
+ * are blocks stored as erasure fragments, which need rebuilding rather
+ * than copying.
+ */
+class Repairer
+{
+  public:
+    Repairer(INIReader &t_config);
+
+    // one repair pass, or with interval_s, a pass every interval_s seconds
+    void repair();
+
+    const uint64_t RPC_TIMEOUT = 10000; // milliseconds
+
+  protected:
+    INIReader &config;
+
+    int replicas;        // copies every block should have
+    double rate_limit_mb; // MB/s of copies, across all servers
+    size_t batch_bytes;  // payload bytes per copy_blocks call, estimated from blocksize
+    int blocksize;
+    int max_busy;        // block RPCs a source may be serving before a batch waits
+    long interval_s;     // between passes; 0 for a single pass
+    string policy;       // the uploader's placement policy, see PlacementPolicy.hpp
+
+    int num_servers;
+    vector<string> ssdhosts;
+    vector<int> ssdports;
+
+    // what we know about one server, kept from pass to pass
+    struct Server
+    {
+        unique_ptr<rpc::client> client;
+        bool live;
+        uint64_t epoch;    // 0 if we never synced with this server
+        uint64_t next_seq; // first sequence number we have not seen
+        BlockDigest digest;
+        uint64_t stored_bytes; // as of the last get_load, plus copies planned since
+    };
+
+    // a block and the servers it is to be copied to, in chain order
+    struct Copy
+    {
+        BlockHash hash;
+        vector<int> chain;
+    };
+
+    void connect(vector<Server> &servers);
+    void sync(vector<Server> &servers);
+    void pass(vector<Server> &servers);
+    bool plan(vector<Server> &servers, vector<vector<Copy>> &copies);
+    void copy(vector<Server> &servers, vector<vector<Copy>> &copies);
+    void wait_forwarded(vector<Server> &servers);
+};
+
+#endif // REPAIRER_HPP
@@ -0,0 +1,141 @@
+#ifndef SHARDEDMAP_HPP
+#define SHARDEDMAP_HPP
+
+#include <map>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <functional>
+
+using namespace std;
+
+/**
+ * A lock-striped map used by the SurfStoreServer when it serves RPCs from
+ * several worker threads.
+ *
+ * Keys are spread over a fixed number of shards by std::hash, and every shard
+ * is a plain std::map guarded by its own mutex. Two RPC handlers only contend
+ * when they touch keys that land in the same shard, so concurrent
+ * store_block/get_block calls scale across cores instead of serializing on
+ * one global lock.
+ *
+ * Values are copied in and out under the shard lock, so callers never race
+ * with a concurrent writer. The one exception is lookup(), see below.
+ */
+template <typename K, typename V>
+class ShardedMap
+{
+  public:
+    explicit ShardedMap(size_t t_num_shards = 64)
+    {
+        for (size_t i = 0; i < t_num_shards; ++i)
+        {
+            shards.push_back(unique_ptr<Shard>(new Shard()));
+        }
+    }
+
+    // insert key -> value only if key is absent. Returns false on duplicates.
+    bool insert(const K &key, const V &value)
+    {
+        Shard &s = shard_for(key);
+        lock_guard<mutex> guard(s.lock);
+        return s.entries.insert(pair<K, V>(key, value)).second;
+    }
+
+    // insert key -> value, overwriting any existing entry
+    void put(const K &key, const V &value)
+    {
+        Shard &s = shard_for(key);
+        lock_guard<mutex> guard(s.lock);
+        s.entries[key] = value;
+    }
+
+    // copy the value for key into value. Returns false if key is absent.
+    bool get(const K &key, V &value) const
+    {
+        Shard &s = shard_for(key);
+        lock_guard<mutex> guard(s.lock);
+        auto it = s.entries.find(key);
+        if (it == s.entries.end())
+        {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+    // pointer to the stored value, or nullptr if key is absent. std::map
+    // nodes never move, so the pointer stays valid for as long as the entry
+    // is neither overwritten by put() nor the map destroyed; only use it for
+    // insert-only maps.
+    const V *lookup(const K &key) const
+    {
+        Shard &s = shard_for(key);
+        lock_guard<mutex> guard(s.lock);
+        auto it = s.entries.find(key);
+        return it == s.entries.end() ? nullptr : &it->second;
+    }
+
+    bool contains(const K &key) const
+    {
+        Shard &s = shard_for(key);
+        lock_guard<mutex> guard(s.lock);
+        return s.entries.find(key) != s.entries.end();
+    }
+
+    size_t size() const
+    {
+        size_t total = 0;
+        for (auto const &s : shards)
+        {
+            lock_guard<mutex> guard(s->lock);
+            total += s->entries.size();
+        }
+        return total;
+    }
+
+    // all keys, taken one shard at a time (not an atomic snapshot across shards)
+    list<K> keys() const
+    {
+        list<K> all_keys;
+        for (auto const &s : shards)
+        {
+            lock_guard<mutex> guard(s->lock);
+            for (auto const &element : s->entries)
+            {
+                all_keys.push_back(element.first);
+            }
+        }
+        return all_keys;
+    }
+
+    // merge every shard back into a single ordered map, e.g. to send it over RPC
+    map<K, V> snapshot() const
+    {
+        map<K, V> merged;
+        for (auto const &s : shards)
+        {
+            lock_guard<mutex> guard(s->lock);
+            merged.insert(s->entries.begin(), s->entries.end());
+        }
+        return merged;
+    }
+
+  protected:
+    struct Shard
+    {
+        mutable mutex lock;
+        map<K, V> entries;
+    };
+
+    // std::mutex is neither copyable nor movable, so shards live on the heap
+    vector<unique_ptr<Shard>> shards;
+
+    Shard &shard_for(const K &key) const
+    {
+        return *shards[hash<K>()(key) % shards.size()];
+    }
+};
+
+#endif // SHARDEDMAP_HPP
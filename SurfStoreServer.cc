@@ -1,14 +1,94 @@
 #include <sysexits.h>
+#include <unistd.h>
 #include <string>
+#include <vector>
+#include <utility>
+#include <map>
 
 #include "rpc/server.h"
 
 #include "logger.hpp"
 #include "SurfStoreTypes.hpp"
 #include "SurfStoreServer.hpp"
+#include "LogBlockStore.hpp"
+#include "TieredBlockStore.hpp"
+#include "ArenaBlockStore.hpp"
+#include "BlockDigest.hpp"
+
+/**
+ * Parse a block hash received over RPC, in either protocol version's
+ * encoding, logging anything that is not a hash at all.
+ */
+static bool parse_hash(const string &wire, BlockHash &hash)
+{
+    if (!BlockHash::from_wire(wire, hash))
+    {
+        auto log = logger();
+        log->error("Malformed block hash of {} bytes", wire.size());
+        return false;
+    }
+    return true;
+}
+
+// counts a block RPC as in flight for as long as it is being served
+struct InFlightGuard
+{
+    atomic<uint64_t> &count;
+    explicit InFlightGuard(atomic<uint64_t> &t_count) : count(t_count) { ++count; }
+    ~InFlightGuard() { --count; }
+};
+
+/**
+ * A block in a get_encoded_blocks reply: a view into the block store, which
+ * goes out as a msgpack bin without being copied. rpclib packs a reply
+ * later, on the session's write strand, so a view of a block the store may
+ * drop (view.owner) is kept alive by the reply's zone until then.
+ */
+struct EncodedBlock
+{
+    BlockView view;
+
+    static void release(void *owner) { delete static_cast<shared_ptr<const string> *>(owner); }
+};
+
+namespace RPCLIB_MSGPACK
+{
+MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+{
+namespace adaptor
+{
+template <> struct object_with_zone<EncodedBlock>
+{
+    void operator()(RPCLIB_MSGPACK::object::with_zone &o, const EncodedBlock &v) const
+    {
+        if (v.view.owner)
+        {
+            unique_ptr<shared_ptr<const string>> owner(new shared_ptr<const string>(v.view.owner));
+            o.zone.push_finalizer(&EncodedBlock::release, owner.get());
+            owner.release();
+        }
+        o.type = RPCLIB_MSGPACK::type::BIN;
+        o.via.bin.size = (uint32_t)v.view.length;
+        o.via.bin.ptr = v.view.data;
+    }
+};
+
+template <> struct pack<EncodedBlock>
+{
+    template <typename Stream>
+    RPCLIB_MSGPACK::packer<Stream> &operator()(RPCLIB_MSGPACK::packer<Stream> &o, const EncodedBlock &v) const
+    {
+        o.pack_bin((uint32_t)v.view.length);
+        o.pack_bin_body(v.view.data, (uint32_t)v.view.length);
+        return o;
+    }
+};
+} // namespace adaptor
+} // MSGPACK_API_VERSION_NAMESPACE
+} // namespace RPCLIB_MSGPACK
 
 SurfStoreServer::SurfStoreServer(INIReader &t_config, int t_servernum)
-    : config(t_config), servernum(t_servernum)
+    : config(t_config), servernum(t_servernum), stored_bytes(0), in_flight(0)
 {
     auto log = logger();
 
@@ -32,6 +112,234 @@ SurfStoreServer::SurfStoreServer(INIReader &t_config, int t_servernum)
         log->error("The port provided is invalid: {}", servconf);
         exit(EX_CONFIG);
     }
+
+    // every server's address, for passing blocks on to the others
+    num_servers = (int)config.GetInteger("ssd", "num_servers", servernum + 1);
+    vector<string> peer_hosts;
+    vector<int> peer_ports;
+    for (int i = 0; i < num_servers; ++i)
+    {
+        string peerconf = config.Get("ssd", "server" + std::to_string(i), "");
+        size_t colon = peerconf.find(":");
+        peer_hosts.push_back(peerconf.substr(0, colon));
+        peer_ports.push_back(colon == string::npos ? 0 : (int)strtol(peerconf.substr(colon + 1).c_str(), nullptr, 0));
+    }
+
+    // how many bytes of chained blocks may wait to be passed on, and how
+    // many store_chained_blocks calls may be in flight to the other servers
+    long forward_bytes = config.GetInteger("ssd", "forward_bytes", 256L * 1024 * 1024);
+    long forward_window = config.GetInteger("ssd", "forward_window", 4);
+    if (forward_bytes <= 0 || forward_window <= 0)
+    {
+        log->error("forward_bytes {} or forward_window {} is invalid", forward_bytes, forward_window);
+        exit(EX_CONFIG);
+    }
+    forwarder.reset(new BlockForwarder(peer_hosts, peer_ports, (size_t)forward_bytes, (size_t)forward_window, RPC_TIMEOUT));
+
+    // number of worker threads serving RPCs
+    num_threads = (int)config.GetInteger("ssd", "num_threads", 1);
+    if (num_threads <= 0)
+    {
+        log->error("num_threads {} is invalid", num_threads);
+        exit(EX_CONFIG);
+    }
+
+    // pick the block storage engine
+    string block_store = config.Get("ssd", "block_store", "memory");
+    if (block_store == "memory")
+    {
+        hdm.reset(new MemoryBlockStore());
+    }
+    else if (block_store == "arena")
+    {
+        // blocks are packed into slabs of this many bytes
+        long slab_size = config.GetInteger("ssd", "slab_size", 64 * 1024 * 1024);
+        if (slab_size <= 0)
+        {
+            log->error("slab_size {} is invalid", slab_size);
+            exit(EX_CONFIG);
+        }
+        hdm.reset(new ArenaBlockStore((size_t)slab_size));
+    }
+    else if (block_store == "log" || block_store == "tiered")
+    {
+        string data_dir = config.Get("ssd", "data_dir", "");
+        if (data_dir == "")
+        {
+            log->error("block_store={} requires a data_dir", block_store);
+            exit(EX_CONFIG);
+        }
+        long segment_size = config.GetInteger("ssd", "segment_size", 256 * 1024 * 1024);
+        if (segment_size <= 0)
+        {
+            log->error("segment_size {} is invalid", segment_size);
+            exit(EX_CONFIG);
+        }
+        bool sync_writes = config.GetBoolean("ssd", "sync_writes", false);
+        // several servers may share a host (and a config file), so each gets its own directory
+        if (block_store == "log")
+        {
+            hdm.reset(new LogBlockStore(data_dir + "/" + serverid, (uint64_t)segment_size, sync_writes));
+        }
+        else
+        {
+            // RAM for blocks; anything beyond it is demoted to disk
+            long max_memory = config.GetInteger("ssd", "max_memory", 1024L * 1024 * 1024);
+            if (max_memory <= 0)
+            {
+                log->error("max_memory {} is invalid", max_memory);
+                exit(EX_CONFIG);
+            }
+            hdm.reset(new TieredBlockStore((uint64_t)max_memory, data_dir + "/" + serverid,
+                                           (uint64_t)segment_size, sync_writes));
+        }
+    }
+    else
+    {
+        log->error("Unknown block_store {}", block_store);
+        exit(EX_CONFIG);
+    }
+    log->info("Using the {} block store", block_store);
+
+    // number the blocks recovered from disk, if any, and add up their size
+    for (const BlockHash &hash : hdm->hashes())
+    {
+        inventory.add(hash);
+        uint64_t bytes;
+        if (hdm->length(hash, bytes))
+        {
+            stored_bytes += bytes;
+        }
+    }
+}
+
+/** update_file(): Updates the FileInfo values associated with a file stored in the cloud.
+ * This method replaces the hash list for the file with
+ * the provided hash list only if the new version number
+ * is exactly one greater than the current version number.
+ * Otherwise, and error is sent to the client telling them that the version
+ * they are trying to store is not right (likely too old).
+ */
+bool SurfStoreServer::update_file(const string &filename, const PackedFileInfo &finfo)
+{
+    auto log = logger();
+    int clientv = get<0>(finfo);
+    if (get<1>(finfo).size() % BlockHash::SIZE != 0)
+    {
+        log->error("Malformed hash list of {} bytes for the file {}", get<1>(finfo).size(), filename);
+        return false;
+    }
+    // insert() only succeeds if the file is not in the fim yet, which keeps
+    // the check-then-create step atomic when several handlers run at once
+    if (fim.insert(filename, finfo)) // Sanity check: new entry in fim
+    {
+        log->info("Creating new entry for file {} in fim", filename);
+        return true;
+    }
+
+    // Files will not be deleted and they will not be modified. After files
+    // are created they are never deleted or modified, so the version number
+    // for files will always be 1.
+    if (clientv != 1) // Sanity check: the provided version has to be exactly one
+    {
+        log->error("The clientv {} is not exactly one for the file {}", clientv, filename);
+        return false; // fail
+    }
+
+    log->info("Update the file {} successful", filename);
+    fim.put(filename, finfo); // the line of code that actually update FileInfoMap
+    return true; // success
+}
+
+// store every block of a store_blocks or store_encoded_blocks call
+vector<bool> SurfStoreServer::store_blocks(const vector<pair<string, string>> &blocks, const string &codecs)
+{
+    auto log = logger();
+    vector<bool> stored;
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        BlockHash hash;
+        if (!parse_hash(blocks[i].first, hash))
+        {
+            stored.push_back(false);
+            continue;
+        }
+        if (i >= codecs.size() || !BlockCodec::valid((uint8_t)codecs[i]))
+        {
+            log->error("Block with hash {} has no valid codec", hash.hex());
+            stored.push_back(false);
+            continue;
+        }
+        bool inserted = hdm->store(hash, blocks[i].second, (BlockCodec::Codec)codecs[i]);
+        if (!inserted)
+        {
+            log->error("Duplicate block hash {} in hdm. Stop.", hash.hex());
+        }
+        else
+        {
+            inventory.add(hash);
+            stored_bytes += blocks[i].second.size();
+        }
+        stored.push_back(inserted);
+    }
+    return stored;
+}
+
+/**
+ * Pass the blocks of a store_chained_blocks or copy_blocks call on to the
+ * next server of each one's chain, with the rest of the chain. Only blocks
+ * this server now holds go on, whether they were stored by this call or
+ * before it.
+ */
+void SurfStoreServer::forward_chains(vector<pair<string, string>> &blocks, const string &codecs, const vector<vector<int>> &chains)
+{
+    auto log = logger();
+
+    map<int, vector<pair<string, string>>> next_blocks;
+    map<int, string> next_codecs;
+    map<int, vector<vector<int>>> next_chains;
+    for (size_t i = 0; i < blocks.size() && i < chains.size() && i < codecs.size(); ++i)
+    {
+        const vector<int> &chain = chains[i];
+        BlockHash hash;
+        if (chain.empty() || !BlockHash::from_wire(blocks[i].first, hash) || !hdm->contains(hash))
+        {
+            continue;
+        }
+        int next = chain[0];
+        if (next < 0 || next >= num_servers || next == servernum)
+        {
+            log->error("Block with hash {} has an invalid chain to server #{}", hash.hex(), next);
+            continue;
+        }
+        next_blocks[next].push_back(move(blocks[i]));
+        next_codecs[next].push_back(codecs[i]);
+        next_chains[next].push_back(vector<int>(chain.begin() + 1, chain.end()));
+    }
+
+    for (auto &entry : next_blocks)
+    {
+        forwarder->forward(entry.first, entry.second, next_codecs[entry.first], next_chains[entry.first]);
+    }
+}
+
+// point view of a stored block at its uncompressed bytes, for get_block and
+// get_blocks: an uncompressed view is left as it is, a compressed one is
+// decoded into a copy that view.owner keeps alive
+void SurfStoreServer::decode_block(const BlockHash &hash, BlockView &view)
+{
+    auto log = logger();
+    if (view.codec == BlockCodec::NONE)
+    {
+        return;
+    }
+    auto block = make_shared<string>();
+    if (!BlockCodec::decode(view.codec, view.data, view.length, *block))
+    {
+        log->error("Block with hash {} does not decompress with {}", hash.hex(), BlockCodec::name(view.codec));
+        block->clear();
+    }
+    view = BlockView{block->data(), block->size(), BlockCodec::NONE, block};
 }
 
 void SurfStoreServer::launch()
@@ -41,6 +349,7 @@ void SurfStoreServer::launch()
     log->info("Launching SurfStore server");
     log->info("My ID is: {}", servernum);
     log->info("Port: {}", port);
+    log->info("Worker threads: {}", num_threads);
 
     rpc::server srv(port);
 
@@ -50,90 +359,308 @@ void SurfStoreServer::launch()
         return;
     });
 
+    /**
+     * The newest protocol version this server speaks. Version 1 servers do
+     * not have this RPC, so clients treat an error as version 1. Every RPC
+     * accepts block hashes in either encoding; only the *_v2 RPCs return
+     * them packed. See SurfStoreTypes.hpp.
+     */
+    srv.bind("get_protocol_version", []() {
+        return PROTOCOL_VERSION;
+    });
+
     /**
      * a new RPC call to your SurfStoreServer that returns a list of all the
      * block hashes stored in that server. This is so that your downloader will know
      * which blocks are stored where.
      */
     srv.bind("get_all_blocks_hashlist", [&](){
-        list<string> all_blocks_hashlist;
-        for (auto const& element : hdm) {
-            all_blocks_hashlist.push_back(element.first);
+        list<string> hashlist;
+        for (const BlockHash &hash : hdm->hashes()) {
+            hashlist.push_back(hash.hex());
         }
-        return all_blocks_hashlist;
+        return hashlist;
+    });
+
+    /**
+     * Counters of the block store, by name, for sizing the server. Every
+     * engine reports "blocks"; block_store=tiered adds its RAM and disk hits,
+     * resident bytes and demotions, see TieredBlockStore.hpp. Counters only
+     * grow, so rates come from polling twice.
+     */
+    srv.bind("get_block_store_stats", [&](){
+        return hdm->stats();
+    });
+
+    /**
+     * How loaded this server is, for placement policies that balance load:
+     * (bytes of blocks stored, block RPCs being served right now). Stored
+     * bytes count blocks as stored, compressed or not. Protocol version 5.
+     */
+    srv.bind("get_load", [&](){
+        return make_tuple((uint64_t)stored_bytes, (uint64_t)in_flight);
+    });
+
+    /**
+     * A compact alternative to get_all_blocks_hashlist: the sorted 64-bit
+     * fingerprints of every stored block hash, 8 bytes per block. See
+     * BlockDigest.hpp.
+     */
+    srv.bind("get_block_digest", [&](){
+        auto log = logger();
+        log->info("get_block_digest()");
+
+        return BlockDigest::build(hdm->hashes());
+    });
+
+    /**
+     * The incremental form of get_block_digest: returns (epoch, next_seq,
+     * fingerprints) where fingerprints covers the blocks stored with sequence
+     * numbers in [seq, next_seq). A client that passes an epoch other than
+     * this server's gets every block, starting from 0. See BlockInventory.hpp.
+     */
+    srv.bind("get_blocks_since", [&](uint64_t epoch, uint64_t seq){
+        auto log = logger();
+        log->info("get_blocks_since() with epoch {} and seq {}", epoch, seq);
+
+        return inventory.since(epoch, seq);
+    });
+
+    /**
+     * Which of the given blocks this server holds: hashes is a packed list
+     * (see BlockHash::pack) and bit i of the returned bitmap (bit i % 8 of
+     * byte i / 8) is set if block i is stored here. Lets clients skip
+     * uploading blocks the server already has.
+     */
+    srv.bind("has_blocks", [&](string hashes) {
+        auto log = logger();
+        vector<BlockHash> hashlist = BlockHash::unpack(hashes);
+        log->info("has_blocks() with {} hashes", hashlist.size());
+
+        string present((hashlist.size() + 7) / 8, '\0');
+        for (size_t i = 0; i < hashlist.size(); ++i) {
+            if (hdm->contains(hashlist[i])) {
+                present[i / 8] |= (char)(1 << (i % 8));
+            }
+        }
+        return present;
     });
 
     /** Get a block for a specific hash
      * Accessing member variables inside a lambda:
      * https://groups.google.com/a/ucsd.edu/forum/#!searchin/crs-cse124_wi19_a00-wi19/get_block|sort:date/crs-cse124_wi19_a00-wi19/pd8Z6T3bAiU/0xHPyFNgAgAJ
+     *
+     * Always returns the block uncompressed, decompressing it here if it was
+     * stored compressed, for clients that predate protocol version 4. An
+     * uncompressed block is an EncodedBlock straight from the block store,
+     * as for get_encoded_blocks.
      */
-    srv.bind("get_block", [&](string hash) {
+    srv.bind("get_block", [&](string wire_hash) {
 
         auto log = logger();
-        log->info("get_block() with hash {}", hash);
-
-        auto it = hdm.find(hash); // map<string,string>::iterator
+        InFlightGuard guard(in_flight);
+        BlockHash hash;
+        EncodedBlock block{BlockView{"", 0, BlockCodec::NONE, nullptr}};
+        if (!parse_hash(wire_hash, hash)) {
+            return block;
+        }
+        log->info("get_block() with hash {}", hash.hex());
 
-        if (it == hdm.end()) { // Sanity check: block with hash do not exist in hdm
-            log->error("Block with hash {} do not exist. Stop.", hash);
-            return string("");
+        if (!hdm->get_view(hash, block.view)) { // Sanity check: block with hash do not exist in hdm
+            log->error("Block with hash {} do not exist. Stop.", hash.hex());
+            return block;
         }
 
-        return (it->second); // first: key, second: value
+        decode_block(hash, block.view);
+        return block;
     });
 
     /** Stores block b in the key-value store, indexed by hash value h
-     * It should store data into the hdm:HashDataMap field.
-     * On the server, blocks and the FileInfoMap are kept in memory.
+     * It should store data into the hdm:BlockStore field.
+     * On the server, the FileInfoMap is kept in memory; blocks are kept in
+     * memory or, with block_store=log, in append-only segment files.
      * The files aren't "reconstituted" onto the server's file system at all.
      * The BlockStore service only knows about blocks–it doesn’t know anything
      * about how blocks relate to files.
      * For hash collisions, we don't have to handle that case for this project.
      */
-    srv.bind("store_block", [&](string hash, string data) {
+    srv.bind("store_block", [&](string wire_hash, string data) {
         auto log = logger();
-        log->info("store_block() with hash {}", hash);
+        InFlightGuard guard(in_flight);
+        BlockHash hash;
+        if (!parse_hash(wire_hash, hash)) {
+            return false;
+        }
+        log->info("store_block() with hash {}", hash.hex());
 
         // Use insert() instead of []. See https://stackoverflow.com/questions/326062/in-stl-maps-is-it-better-to-use-mapinsert-than
-        auto ret = hdm.insert(pair<string,string>(hash,data));
+        bool inserted = hdm->store(hash, data, BlockCodec::NONE);
 
-        if (ret.second == false) {
-            log->error("Duplicate block hash {} in hdm. Stop.", hash);
+        if (!inserted) {
+            log->error("Duplicate block hash {} in hdm. Stop.", hash.hex());
+        } else {
+            inventory.add(hash);
+            stored_bytes += data.size();
         }
 
-        return ret.second;
+        return inserted;
     });
 
-    // update the FileInfo entry for a given file
-    /** update_file(): Updates the FileInfo values associated with a file stored in the cloud.
-     * This method replaces the hash list for the file with
-     * the provided hash list only if the new version number
-     * is exactly one greater than the current version number.
-     * Otherwise, and error is sent to the client telling them that the version
-     * they are trying to store is not right (likely too old).
+    /** Batched store_block: stores every (hash, data) pair in one round trip.
+     * Returns one flag per block, in order, with the same meaning as
+     * store_block's return value.
      */
-    srv.bind("update_file", [&](string filename, FileInfo finfo) {
-        int clientv = get<0>(finfo);
-        //find the given file's fileinfo
-        auto fimit = fim.find(filename);
-        //can't find the file in the fim
-        if (fimit == fim.end()) { // Sanity check: new entry in fim
-            log->info("Creating new entry for file {} in fim", filename);
-            fim[filename] = finfo;
-            return true;
+    srv.bind("store_blocks", [&](vector<pair<string, string>> blocks) {
+        auto log = logger();
+        InFlightGuard guard(in_flight);
+        log->info("store_blocks() with {} blocks", blocks.size());
+
+        return store_blocks(blocks, string(blocks.size(), (char)BlockCodec::NONE));
+    });
+
+    /** store_blocks for blocks that may be compressed: codecs[i] is the
+     * BlockCodec::Codec of blocks[i].second, which is stored as it is.
+     * Protocol version 4.
+     */
+    srv.bind("store_encoded_blocks", [&](vector<pair<string, string>> blocks, string codecs) {
+        auto log = logger();
+        InFlightGuard guard(in_flight);
+        log->info("store_encoded_blocks() with {} blocks", blocks.size());
+
+        return store_blocks(blocks, codecs);
+    });
+
+    /** store_encoded_blocks for blocks that more servers are to hold:
+     * chains[i] lists, in order, the servers blocks[i] is passed on to. The
+     * reply comes as soon as the blocks are stored here; this server then
+     * sends each block to the first server of its chain, with the rest of
+     * the chain, over its own link, so a client uploads every block once
+     * whatever the number of copies. Protocol version 6.
+     */
+    srv.bind("store_chained_blocks", [&](vector<pair<string, string>> blocks, string codecs, vector<vector<int>> chains) {
+        auto log = logger();
+        InFlightGuard guard(in_flight);
+        log->info("store_chained_blocks() with {} blocks", blocks.size());
+
+        vector<bool> stored = store_blocks(blocks, codecs);
+        forward_chains(blocks, codecs, chains);
+        return stored;
+    });
+
+    /** Copy blocks this server holds to other servers, for the repairer:
+     * block hashes[i] is sent down chains[i], as store_chained_blocks would.
+     * Returns the stored size of every block, 0 for blocks this server does
+     * not hold, as soon as they are queued. Protocol version 7.
+     */
+    srv.bind("copy_blocks", [&](vector<string> hashes, vector<vector<int>> chains) {
+        auto log = logger();
+        InFlightGuard guard(in_flight);
+        log->info("copy_blocks() with {} blocks", hashes.size());
+
+        vector<pair<string, string>> blocks;
+        string codecs;
+        vector<vector<int>> held_chains;
+        vector<uint64_t> sizes;
+        for (size_t i = 0; i < hashes.size() && i < chains.size(); ++i)
+        {
+            BlockHash hash;
+            string data;
+            BlockCodec::Codec codec;
+            if (!parse_hash(hashes[i], hash) || !hdm->get(hash, data, codec))
+            {
+                sizes.push_back(0);
+                continue;
+            }
+            sizes.push_back(data.size());
+            blocks.push_back(make_pair(hashes[i], move(data)));
+            codecs.push_back((char)codec);
+            held_chains.push_back(chains[i]);
+        }
+        forward_chains(blocks, codecs, held_chains);
+        return sizes;
+    });
+
+    /** What the forwarder is doing: (bytes queued or in flight, bytes
+     * forwarded, blocks that failed to forward) since the server started.
+     * Protocol version 7.
+     */
+    srv.bind("get_forward_stats", [&]() {
+        return make_tuple((uint64_t)forwarder->backlog_bytes(), (uint64_t)forwarder->forwarded_bytes(),
+                          (uint64_t)forwarder->failed_blocks());
+    });
+
+    /** Batched get_block: returns the blocks for every hash, in order, with
+     * an empty block for any hash this server does not hold. Like get_block,
+     * every block is returned uncompressed.
+     */
+    srv.bind("get_blocks", [&](vector<string> hashes) {
+        auto log = logger();
+        InFlightGuard guard(in_flight);
+        log->info("get_blocks() with {} hashes", hashes.size());
+
+        vector<EncodedBlock> blocks(hashes.size(), EncodedBlock{BlockView{"", 0, BlockCodec::NONE, nullptr}});
+        for (size_t i = 0; i < hashes.size(); ++i) {
+            BlockHash hash;
+            if (!parse_hash(hashes[i], hash)) {
+                continue;
+            }
+            if (!hdm->get_view(hash, blocks[i].view)) {
+                log->error("Block with hash {} do not exist. Stop.", hash.hex());
+                continue;
+            }
+            decode_block(hash, blocks[i].view);
         }
+        return blocks;
+    });
+
+    /** get_blocks for clients that can decompress (protocol version 4):
+     * returns (codecs, blocks), where blocks[i] is the block for hashes[i]
+     * exactly as it was stored and codecs[i] is its BlockCodec::Codec. A
+     * block this server does not hold comes back empty and uncompressed.
+     *
+     * The blocks are EncodedBlocks pointing into the block store (an
+     * mmap'd segment with block_store=log) rather than std::strings, so
+     * their bytes are copied exactly once: straight into the response
+     * buffer. Clients read them with .as<vector<string>>().
+     */
+    srv.bind("get_encoded_blocks", [&](vector<string> hashes) {
+        auto log = logger();
+        InFlightGuard guard(in_flight);
+        log->info("get_encoded_blocks() with {} hashes", hashes.size());
 
-        // Files will not be deleted and they will not be modified. After files
-        // are created they are never deleted or modified, so the version number
-        // for files will always be 1.
-        if (clientv != 1) { // Sanity check: the provided version has to be exactly one
-            log->error("The clientv {} is not exactly one for the file {}", clientv, filename);
-            return false; // fail
+        string codecs(hashes.size(), (char)BlockCodec::NONE);
+        vector<EncodedBlock> blocks(hashes.size(), EncodedBlock{BlockView{"", 0, BlockCodec::NONE, nullptr}});
+        for (size_t i = 0; i < hashes.size(); ++i) {
+            BlockHash hash;
+            if (!parse_hash(hashes[i], hash)) {
+                continue;
+            }
+            if (!hdm->get_view(hash, blocks[i].view)) {
+                log->error("Block with hash {} do not exist. Stop.", hash.hex());
+                continue;
+            }
+            codecs[i] = (char)blocks[i].view.codec;
         }
+        return make_pair(codecs, blocks);
+    });
 
-        log->info("Update the file {} successful", filename);
-        fim[filename] = finfo; // the line of code that actually update FileInfoMap
-        return true; // success
+    // update the FileInfo entry for a given file, see update_file()
+    srv.bind("update_file_v2", [&](string filename, PackedFileInfo finfo) {
+        return update_file(filename, finfo);
+    });
+
+    // the protocol version 1 form of update_file_v2, with a list of hex hashes
+    srv.bind("update_file", [&](string filename, FileInfo finfo) {
+        vector<BlockHash> hashlist;
+        for (const string &wire_hash : get<1>(finfo)) {
+            BlockHash hash;
+            if (!parse_hash(wire_hash, hash)) {
+                return false;
+            }
+            hashlist.push_back(hash);
+        }
+        PackedFileInfo packed = make_tuple(get<0>(finfo), BlockHash::pack(hashlist));
+        return update_file(filename, packed);
     });
 
     /** Download a FileInfo Map from the server
@@ -153,11 +680,41 @@ void SurfStoreServer::launch()
         fmap["file1.txt"] = file1;
         fmap["file2.dat"] = file2;
      */
+    srv.bind("get_fileinfo_map_v2", [&]() {
+        auto log = logger();
+        log->info("get_fileinfo_map_v2()");
+
+        return fim.snapshot();
+    });
+
+    // the protocol version 1 form of get_fileinfo_map_v2, with lists of hex hashes
     srv.bind("get_fileinfo_map", [&]() {
         auto log = logger();
         log->info("get_fileinfo_map()");
 
-        return fim;
+        FileInfoMap fmap;
+        for (auto const &entry : fim.snapshot()) {
+            list<string> hashlist;
+            for (const BlockHash &hash : BlockHash::unpack(get<1>(entry.second))) {
+                hashlist.push_back(hash.hex());
+            }
+            fmap[entry.first] = make_tuple(get<0>(entry.second), hashlist);
+        }
+        return fmap;
     });
-    srv.run();
+
+    if (num_threads == 1)
+    {
+        srv.run();
+    }
+    else
+    {
+        // async_run() hands the RPCs to a pool of worker threads and returns
+        // immediately, so park the launching thread for the server's lifetime
+        srv.async_run(num_threads);
+        for (;;)
+        {
+            pause();
+        }
+    }
 }
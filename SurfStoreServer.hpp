@@ -2,7 +2,17 @@
 #define SURFSTORESERVER_HPP
 
 #include "inih/INIReader.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "logger.hpp"
+#include "BlockStore.hpp"
+#include "BlockInventory.hpp"
+#include "BlockForwarder.hpp"
+#include "ShardedMap.hpp"
 #include "SurfStoreTypes.hpp"
 
 using namespace std;
@@ -19,9 +29,21 @@ class SurfStoreServer
   protected:
     INIReader &config;
     const int servernum;
+    int num_servers;
     int port;
-    FileInfoMap fim;
-    HashDataMap hdm;
+    int num_threads; // RPC worker threads; 1 serves every call on the launching thread
+    // Both stores are safe to use from concurrent RPC handlers
+    ShardedMap<string, PackedFileInfo> fim; // hash lists are kept packed whatever the client speaks
+    unique_ptr<BlockStore> hdm; // "memory" (default), "arena", "log" or "tiered", see [ssd] block_store
+    BlockInventory inventory;   // sequence numbers of the blocks in hdm
+    atomic<uint64_t> stored_bytes; // payload bytes in hdm, as stored, for get_load
+    atomic<uint64_t> in_flight;    // block RPCs being served right now
+    unique_ptr<BlockForwarder> forwarder; // passes store_chained_blocks on down their chains
+
+    bool update_file(const string &filename, const PackedFileInfo &finfo);
+    vector<bool> store_blocks(const vector<pair<string, string>> &blocks, const string &codecs);
+    void forward_chains(vector<pair<string, string>> &blocks, const string &codecs, const vector<vector<int>> &chains);
+    void decode_block(const BlockHash &hash, BlockView &view);
 };
 
 #endif // SURFSTORESERVER_HPP
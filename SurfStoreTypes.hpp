@@ -6,15 +6,33 @@
 #include <list>
 #include <string>
 
+#include "BlockHash.hpp"
+
+// Protocol version 1 carries block hashes as 64-char hex strings
 typedef tuple<int, list<string>> FileInfo; // tuple(version:int, hashlist:list<string>
 typedef map<string, FileInfo> FileInfoMap; // filename:string -> tuple(version:int, hashlist:list<string>)
-typedef map<string, string> HashDataMap; // hash: string -> data_block: string
 
+// Protocol version 2 carries them as raw 32-byte BlockHashes; a file's hash
+// list is packed into one string, see BlockHash::pack()
+typedef tuple<int, string> PackedFileInfo; // tuple(version:int, packed hashlist:string)
+typedef map<string, PackedFileInfo> PackedFileInfoMap; // filename:string -> tuple(version:int, packed hashlist:string)
+
+// the newest protocol version spoken by this code, see get_protocol_version.
+// Version 3 adds has_blocks, version 4 compressed blocks
+// (store_encoded_blocks, get_encoded_blocks), version 5 get_load, version 6
+// store_chained_blocks, version 7 copy_blocks and get_forward_stats.
+const int PROTOCOL_VERSION = 7;
 
 const string RAND = "random";
 const string TWO_RAND = "tworandom";
 const string LOCAL = "local";
 const string LOCAL_CLOSE = "localclosest";
 const string LOCAL_FAR = "localfarthest";
+const string TWO_CHOICES = "twochoices";
+const string ERASURE = "erasure";
+const string RENDEZVOUS = "rendezvous";
+
+// hash of the empty block, which get_block legitimately returns as ""
+const BlockHash EMPTY_BLOCK_HASH = BlockHash::from_hex("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
 
 #endif // SURFSTORETYPES_HPP
@@ -0,0 +1,301 @@
+#include <string>
+#include <unordered_set>
+
+#include "logger.hpp"
+#include "TieredBlockStore.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+// A1in holds up to this share of max_memory, A1out remembers demoted blocks
+// worth up to GHOST_SHARE of it; the values the 2Q paper recommends
+static const double A1IN_SHARE = 0.25;
+static const double GHOST_SHARE = 0.5;
+
+TieredBlockStore::TieredBlockStore(uint64_t t_max_memory, string t_data_dir, uint64_t t_segment_size, bool t_sync_writes)
+    : max_memory(t_max_memory), disk(t_data_dir, t_segment_size, t_sync_writes),
+      resident(0), a1in_bytes(0), ghost_bytes(0), demoting_bytes(0),
+      ram_hits(0), disk_hits(0), misses(0), demotions(0), demoted_bytes(0), promotions(0),
+      started(steady_clock::now())
+{
+}
+
+bool TieredBlockStore::store(const BlockHash &hash, const string &data, BlockCodec::Codec codec)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        if (ram.count(hash) > 0 || disk.contains(hash))
+        {
+            return false;
+        }
+
+        a1in.push_front(hash);
+        ram[hash] = RamBlock{make_shared<const string>(data), codec, A1IN, a1in.begin(), false, false};
+        resident += data.size();
+        a1in_bytes += data.size();
+        forget_ghost(hash);
+    }
+
+    demote();
+    return true;
+}
+
+bool TieredBlockStore::get(const BlockHash &hash, string &data, BlockCodec::Codec &codec)
+{
+    BlockView view;
+    if (!find(hash, view))
+    {
+        return false;
+    }
+    data.assign(view.data, view.length);
+    codec = view.codec;
+    return true;
+}
+
+bool TieredBlockStore::get_view(const BlockHash &hash, BlockView &view)
+{
+    // a RAM block stays alive through view.owner; disk views point into
+    // segments that are never unmapped
+    return find(hash, view);
+}
+
+// unlike get_view, leaves a block on disk there and the queues as they are
+bool TieredBlockStore::length(const BlockHash &hash, uint64_t &bytes)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        auto it = ram.find(hash);
+        if (it != ram.end())
+        {
+            bytes = it->second.data->size();
+            return true;
+        }
+    }
+    // only looks the block up in the disk tier's index
+    return disk.length(hash, bytes);
+}
+
+bool TieredBlockStore::contains(const BlockHash &hash)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        if (ram.count(hash) > 0)
+        {
+            return true;
+        }
+    }
+    return disk.contains(hash);
+}
+
+list<BlockHash> TieredBlockStore::hashes()
+{
+    unordered_set<BlockHash> in_ram;
+    {
+        lock_guard<mutex> guard(lock);
+        for (auto const &entry : ram)
+        {
+            in_ram.insert(entry.first);
+        }
+    }
+
+    list<BlockHash> all(in_ram.begin(), in_ram.end());
+    for (const BlockHash &hash : disk.hashes())
+    {
+        if (in_ram.count(hash) == 0)
+        {
+            all.push_back(hash);
+        }
+    }
+    return all;
+}
+
+size_t TieredBlockStore::size()
+{
+    size_t only_in_ram = 0;
+    {
+        lock_guard<mutex> guard(lock);
+        for (auto const &entry : ram)
+        {
+            only_in_ram += !entry.second.on_disk;
+        }
+    }
+    return only_in_ram + disk.size();
+}
+
+map<string, uint64_t> TieredBlockStore::stats()
+{
+    size_t on_disk = disk.size();
+    lock_guard<mutex> guard(lock);
+
+    map<string, uint64_t> out;
+    out["max_memory"] = max_memory;
+    out["resident_bytes"] = resident;
+    out["resident_blocks"] = ram.size();
+    out["disk_blocks"] = on_disk;
+    out["ram_hits"] = ram_hits;
+    out["disk_hits"] = disk_hits;
+    out["misses"] = misses;
+    out["demotions"] = demotions;
+    out["demoted_bytes"] = demoted_bytes;
+    out["promotions"] = promotions;
+    out["uptime_ms"] = duration_cast<milliseconds>(steady_clock::now() - started).count();
+    return out;
+}
+
+/**
+ * Look a block up in RAM, then on disk. view.owner is set for a RAM block,
+ * and keeps its bytes alive while view is in use. A block read from disk is
+ * copied back into RAM: into Am if it was demoted from A1in not long ago,
+ * which shows it is hot, and into A1in like a new block otherwise.
+ */
+bool TieredBlockStore::find(const BlockHash &hash, BlockView &view)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        auto it = ram.find(hash);
+        if (it != ram.end())
+        {
+            RamBlock &block = it->second;
+            if (block.queue == AM && !block.demoting)
+            {
+                am.splice(am.begin(), am, block.pos);
+            }
+            view = BlockView{block.data->data(), block.data->size(), block.codec, block.data};
+            ++ram_hits;
+            return true;
+        }
+    }
+
+    if (!disk.get_view(hash, view))
+    {
+        lock_guard<mutex> guard(lock);
+        ++misses;
+        return false;
+    }
+
+    // the view points into the disk tier and stays valid; the copy is for
+    // the next reader
+    shared_ptr<const string> data = make_shared<const string>(view.data, view.length);
+    {
+        lock_guard<mutex> guard(lock);
+        ++disk_hits;
+        if (ram.count(hash) > 0)
+        {
+            return true; // another reader brought it back first
+        }
+        if (ghosts.count(hash) > 0)
+        {
+            forget_ghost(hash);
+            am.push_front(hash);
+            ram[hash] = RamBlock{data, view.codec, AM, am.begin(), true, false};
+        }
+        else
+        {
+            a1in.push_front(hash);
+            ram[hash] = RamBlock{data, view.codec, A1IN, a1in.begin(), true, false};
+            a1in_bytes += data->size();
+        }
+        resident += data->size();
+        ++promotions;
+    }
+    demote();
+    return true;
+}
+
+// drop hash from A1out; lock must be held
+void TieredBlockStore::forget_ghost(const BlockHash &hash)
+{
+    auto it = ghosts.find(hash);
+    if (it != ghosts.end())
+    {
+        ghost_bytes -= it->second->second;
+        a1out.erase(it->second);
+        ghosts.erase(it);
+    }
+}
+
+/**
+ * Bring RAM back under max_memory. Victims are picked under the lock but
+ * written to disk outside it, so reads and stores carry on meanwhile; a
+ * block stays in RAM, and readable, until its write has finished.
+ */
+void TieredBlockStore::demote()
+{
+    auto log = logger();
+
+    vector<pair<BlockHash, RamBlock>> victims;
+    {
+        lock_guard<mutex> guard(lock);
+        while (resident - demoting_bytes > max_memory)
+        {
+            // 2Q: trim A1in while it is over its share, then the LRU end of Am
+            list<BlockHash> *from = nullptr;
+            if (!a1in.empty() && (a1in_bytes > A1IN_SHARE * max_memory || am.empty()))
+            {
+                from = &a1in;
+            }
+            else if (!am.empty())
+            {
+                from = &am;
+            }
+            else
+            {
+                break; // every block in RAM is on its way to disk already
+            }
+
+            BlockHash hash = from->back();
+            from->pop_back();
+            RamBlock &block = ram[hash];
+            uint64_t length = block.data->size();
+            if (block.queue == A1IN)
+            {
+                a1in_bytes -= length;
+                a1out.push_front(make_pair(hash, length));
+                ghosts[hash] = a1out.begin();
+                ghost_bytes += length;
+                while (ghost_bytes > GHOST_SHARE * max_memory)
+                {
+                    ghost_bytes -= a1out.back().second;
+                    ghosts.erase(a1out.back().first);
+                    a1out.pop_back();
+                }
+            }
+
+            if (block.on_disk)
+            {
+                // a clean copy, nothing to write
+                resident -= length;
+                ram.erase(hash);
+                continue;
+            }
+            block.demoting = true;
+            demoting_bytes += length;
+            victims.push_back(make_pair(hash, block));
+        }
+    }
+
+    for (auto &victim : victims)
+    {
+        const RamBlock &block = victim.second;
+        bool written = disk.store(victim.first, *block.data, block.codec) || disk.contains(victim.first);
+
+        lock_guard<mutex> guard(lock);
+        uint64_t length = block.data->size();
+        demoting_bytes -= length;
+        auto it = ram.find(victim.first);
+        if (!written)
+        {
+            // keep it in RAM and try again on a later demotion
+            log->error("Unable to demote block {} to disk", victim.first.hex());
+            am.push_front(victim.first);
+            it->second.queue = AM;
+            it->second.pos = am.begin();
+            it->second.demoting = false;
+            continue;
+        }
+        resident -= length;
+        ram.erase(it);
+        ++demotions;
+        demoted_bytes += length;
+    }
+}
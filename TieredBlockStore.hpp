@@ -0,0 +1,109 @@
+#ifndef TIEREDBLOCKSTORE_HPP
+#define TIEREDBLOCKSTORE_HPP
+
+#include <stdint.h>
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "BlockStore.hpp"
+#include "LogBlockStore.hpp"
+
+using namespace std;
+
+/**
+ * A block store that keeps at most max_memory bytes of blocks in RAM and
+ * the rest on disk, in a LogBlockStore.
+ *
+ * New blocks go to RAM. Once RAM holds more than max_memory bytes, cold
+ * blocks are demoted: written to the disk tier and dropped from RAM. Reads
+ * of demoted blocks are served from the disk tier's mmap'd segments, so a
+ * miss costs a page fault rather than an error.
+ *
+ * What stays in RAM is decided by 2Q (Johnson & Shasha, VLDB '94):
+ *
+ *   A1in  - FIFO of blocks stored, or read from disk, recently; at most a
+ *           quarter of max_memory. A block read again while in A1in stays
+ *           where it is, so one burst of reads does not make a block hot.
+ *   A1out - the hashes (not the data) of blocks recently demoted from A1in.
+ *   Am    - LRU of blocks that proved hot: read again after leaving A1in,
+ *           which a hit on A1out detects.
+ *
+ * A block read from disk is copied back into RAM, into Am on an A1out hit
+ * and into A1in otherwise; blocks on disk already are dropped from RAM
+ * again without a write.
+ *
+ * Blocks read only once, like a downloader streaming a large file, pass
+ * through A1in and never displace the hot set in Am.
+ *
+ * Blocks still in RAM are lost on restart, as with the memory store;
+ * demoted blocks are recovered from disk.
+ *
+ * A view of a block in RAM shares its bytes through view.owner, so it stays
+ * valid even if the block is demoted in the meantime.
+ */
+class TieredBlockStore : public BlockStore
+{
+  public:
+    TieredBlockStore(uint64_t t_max_memory, string t_data_dir, uint64_t t_segment_size, bool t_sync_writes);
+
+    bool store(const BlockHash &hash, const string &data, BlockCodec::Codec codec);
+    bool get(const BlockHash &hash, string &data, BlockCodec::Codec &codec);
+    bool get_view(const BlockHash &hash, BlockView &view);
+    bool length(const BlockHash &hash, uint64_t &bytes);
+    bool contains(const BlockHash &hash);
+    list<BlockHash> hashes();
+    size_t size();
+    map<string, uint64_t> stats();
+
+  protected:
+    enum Queue
+    {
+        A1IN,
+        AM,
+    };
+
+    struct RamBlock
+    {
+        shared_ptr<const string> data;
+        BlockCodec::Codec codec;
+        Queue queue;
+        list<BlockHash>::iterator pos; // in a1in or am, unless demoting
+        bool on_disk;  // a clean copy of a block on disk, dropped without a write
+        bool demoting; // taken off its queue and being written to disk
+    };
+
+    uint64_t max_memory;
+    LogBlockStore disk;
+
+    mutex lock; // guards everything below
+    unordered_map<BlockHash, RamBlock> ram;
+    list<BlockHash> a1in; // newest first
+    list<BlockHash> am;   // most recently used first
+    list<pair<BlockHash, uint64_t>> a1out; // (hash, length), newest first
+    unordered_map<BlockHash, list<pair<BlockHash, uint64_t>>::iterator> ghosts; // index into a1out
+    uint64_t resident;  // bytes of blocks in RAM
+    uint64_t a1in_bytes;
+    uint64_t ghost_bytes;
+    uint64_t demoting_bytes;
+
+    uint64_t ram_hits;
+    uint64_t disk_hits;
+    uint64_t misses;
+    uint64_t demotions;
+    uint64_t demoted_bytes;
+    uint64_t promotions; // blocks copied back into RAM from disk
+    chrono::steady_clock::time_point started;
+
+    bool find(const BlockHash &hash, BlockView &view);
+    void forget_ghost(const BlockHash &hash);
+    void demote();
+};
+
+#endif // TIEREDBLOCKSTORE_HPP
@@ -0,0 +1,315 @@
+#include <string>
+#include <vector>
+
+#include "logger.hpp"
+#include "UploadEngine.hpp"
+#include "Protocol.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+// what dedup tells apart: a block, and the servers it is passed on to
+static string dedup_key(const BlockHash &hash, const vector<int> &chain)
+{
+    string key = hash.raw();
+    for (int server : chain)
+    {
+        key.append((const char *)&server, sizeof(server));
+    }
+    return key;
+}
+
+UploadEngine::UploadEngine(vector<rpc::client *> &t_clients, LatencyTracker &t_latency, size_t t_batch_bytes, size_t t_window,
+                           int t_protocol, bool t_dedup)
+    : clients(t_clients), latency(t_latency), batch_bytes(t_batch_bytes), window(t_window), protocol(t_protocol), dedup(t_dedup),
+      pending(t_clients.size()), pending_hashes(t_clients.size()), pending_codecs(t_clients.size()),
+      pending_chains(t_clients.size()), pending_bytes(t_clients.size(), 0), in_flight(t_clients.size()),
+      queued(t_clients.size()), success(true),
+      bytes_uploaded(t_clients.size(), 0), bytes_present(t_clients.size(), 0), bytes_repeated(t_clients.size(), 0), busy_time(t_clients.size(), high_resolution_clock::duration::zero()),
+      busy_since(t_clients.size())
+{
+}
+
+void UploadEngine::add(int server, const BlockHash &hash, BlockCodec::Codec codec, const string &block,
+                       const vector<int> &chain)
+{
+    if (dedup && !queued[server].insert(dedup_key(hash, chain)).second)
+    {
+        bytes_repeated[server] += block.size();
+        return;
+    }
+
+    pending[server].push_back(make_pair(hash.raw(), block));
+    pending_hashes[server].push_back(hash);
+    pending_codecs[server].push_back((char)codec);
+    pending_chains[server].push_back(chain);
+    pending_bytes[server] += block.size();
+
+    if (pending_bytes[server] >= batch_bytes)
+    {
+        send(server);
+    }
+}
+
+bool UploadEngine::finish()
+{
+    for (size_t server = 0; server < pending.size(); ++server)
+    {
+        if (!pending[server].empty())
+        {
+            send(server);
+        }
+    }
+
+    // drain in completion order, rather than server by server, so that a
+    // fast server's busy time isn't stretched by waiting on a slow one
+    bool outstanding = true;
+    while (outstanding)
+    {
+        outstanding = false;
+        reap_ready();
+        for (size_t server = 0; server < in_flight.size(); ++server)
+        {
+            if (!in_flight[server].empty())
+            {
+                outstanding = true;
+                in_flight[server].front().reply.wait_for(milliseconds(1));
+                break;
+            }
+        }
+    }
+
+    bool result = success;
+    success = true;
+    return result;
+}
+
+void UploadEngine::report()
+{
+    auto log = logger();
+
+    for (size_t server = 0; server < clients.size(); ++server)
+    {
+        double secs = duration_cast<microseconds>(busy_time[server]).count() / 1e6;
+        double mb = bytes_uploaded[server] / 1e6;
+        log->error("Uploaded {:.1f} MB to server #{} in {:.3f} seconds: {:.2f} MB/s",
+                   mb, server, secs, secs > 0 ? mb / secs : 0.0);
+        if (dedup)
+        {
+            log->error("Skipped {:.1f} MB already on server #{} and {:.1f} MB repeated in this upload",
+                       bytes_present[server] / 1e6, server, bytes_repeated[server] / 1e6);
+        }
+    }
+}
+
+/**
+ * Ship everything queued for server with one asynchronous call, first
+ * waiting for the oldest outstanding call if the window is full. The call
+ * is store_blocks, or with dedup, has_blocks followed by a store_blocks of
+ * the missing blocks once its reply is in.
+ */
+void UploadEngine::send(int server)
+{
+    auto log = logger();
+
+    reap_ready();
+    while (in_flight[server].size() >= window)
+    {
+        wait_oldest(server);
+    }
+
+    if (in_flight[server].empty())
+    {
+        busy_since[server] = high_resolution_clock::now();
+    }
+
+    if (!dedup)
+    {
+        store(server, pending[server], pending_hashes[server], pending_codecs[server], pending_chains[server],
+              pending_bytes[server]);
+        pending_bytes[server] = 0;
+        return;
+    }
+
+    log->info("Checking a batch of {} blocks ({} bytes) with server #{}", pending[server].size(), pending_bytes[server], server);
+
+    InFlight call;
+    call.reply = clients[server]->async_call("has_blocks", BlockHash::pack(pending_hashes[server]));
+    call.sent = high_resolution_clock::now();
+    call.bytes = pending_bytes[server];
+    call.call = CHECK;
+    call.hashes.swap(pending_hashes[server]);
+    call.batch.swap(pending[server]);
+    call.codecs.swap(pending_codecs[server]);
+    call.chains.swap(pending_chains[server]);
+    in_flight[server].push_back(move(call));
+
+    pending_bytes[server] = 0;
+}
+
+// send batch with store_blocks, leaving batch, hashes, codecs and chains empty
+void UploadEngine::store(int server, vector<pair<string, string>> &batch, vector<BlockHash> &hashes, string &codecs,
+                         vector<vector<int>> &chains, size_t bytes)
+{
+    auto log = logger();
+
+    log->info("Uploading a batch of {} blocks ({} bytes) to server #{}", batch.size(), bytes, server);
+
+    bool chained = false;
+    for (const vector<int> &chain : chains)
+    {
+        chained = chained || !chain.empty();
+    }
+
+    // async_call serializes its arguments right away, so the batch can be
+    // reused as soon as it returns
+    InFlight call;
+    if (chained)
+    {
+        call.reply = clients[server]->async_call("store_chained_blocks", batch, codecs, chains);
+    }
+    else
+    {
+        call.reply = protocol >= 4 ? clients[server]->async_call("store_encoded_blocks", batch, codecs)
+                                   : clients[server]->async_call("store_blocks", batch);
+    }
+    call.sent = high_resolution_clock::now();
+    call.bytes = bytes;
+    call.call = STORE;
+    call.hashes.swap(hashes);
+    call.chains.swap(chains);
+    in_flight[server].push_back(move(call));
+
+    batch.clear();
+    codecs.clear();
+}
+
+// have server pass the blocks it already holds on down their chains with
+// copy_blocks, leaving hashes and chains empty
+void UploadEngine::copy(int server, vector<BlockHash> &hashes, vector<vector<int>> &chains, size_t bytes)
+{
+    auto log = logger();
+
+    log->info("Having server #{} pass on {} blocks ({} bytes) it already holds", server, hashes.size(), bytes);
+
+    vector<string> wire_hashes;
+    for (const BlockHash &hash : hashes)
+    {
+        wire_hashes.push_back(hash.raw());
+    }
+
+    InFlight call;
+    call.reply = clients[server]->async_call("copy_blocks", wire_hashes, chains);
+    call.sent = high_resolution_clock::now();
+    call.bytes = bytes;
+    call.call = COPY;
+    call.hashes.swap(hashes);
+    call.chains.swap(chains);
+    in_flight[server].push_back(move(call));
+}
+
+void UploadEngine::wait_oldest(int server)
+{
+    auto log = logger();
+    InFlight call = move(in_flight[server].front());
+    in_flight[server].pop_front();
+
+    call.reply.wait();
+    if (call.call == CHECK)
+    {
+        // a store or copy takes as long as its payload; only has_blocks
+        // times the network
+        latency.observe(server, duration_cast<nanoseconds>(high_resolution_clock::now() - call.sent).count() / 1e3);
+    }
+
+    if (call.call == CHECK)
+    {
+        // bit i of the reply is set if the server has block i
+        string present = call.reply.get().as<string>();
+        vector<pair<string, string>> missing;
+        vector<BlockHash> missing_hashes;
+        string missing_codecs;
+        vector<vector<int>> missing_chains;
+        size_t missing_bytes = 0;
+        vector<BlockHash> held_hashes; // present, but still to be passed on
+        vector<vector<int>> held_chains;
+        size_t held_bytes = 0;
+        for (size_t i = 0; i < call.hashes.size(); ++i)
+        {
+            bool held = i / 8 < present.size() && (present[i / 8] >> (i % 8) & 1);
+            if (held && !call.chains[i].empty() && protocol >= 7)
+            {
+                bytes_present[server] += call.batch[i].second.size();
+                held_bytes += call.batch[i].second.size();
+                held_hashes.push_back(call.hashes[i]);
+                held_chains.push_back(call.chains[i]);
+                continue;
+            }
+            if (held && call.chains[i].empty())
+            {
+                bytes_present[server] += call.batch[i].second.size();
+                continue;
+            }
+            missing_bytes += call.batch[i].second.size();
+            missing.push_back(move(call.batch[i]));
+            missing_hashes.push_back(call.hashes[i]);
+            missing_codecs.push_back(call.codecs[i]);
+            missing_chains.push_back(call.chains[i]);
+        }
+        if (!missing.empty())
+        {
+            store(server, missing, missing_hashes, missing_codecs, missing_chains, missing_bytes);
+        }
+        if (!held_hashes.empty())
+        {
+            copy(server, held_hashes, held_chains, held_bytes);
+        }
+    }
+    else if (call.call == COPY)
+    {
+        // the size of every block passed on, 0 if the server lost it since
+        vector<uint64_t> sizes = call.reply.get().as<vector<uint64_t>>();
+        for (size_t i = 0; i < call.hashes.size(); ++i)
+        {
+            if (i >= sizes.size() || sizes[i] == 0)
+            {
+                success = false;
+                queued[server].erase(dedup_key(call.hashes[i], call.chains[i]));
+                log->error("Fail passing on block with hash {} from server #{}. Skip.", call.hashes[i].hex(), server);
+            }
+        }
+    }
+    else
+    {
+        vector<bool> stored = call.reply.get().as<vector<bool>>();
+        for (size_t i = 0; i < call.hashes.size(); ++i)
+        {
+            if (i >= stored.size() || !stored[i])
+            {
+                success = false;
+                // a later add() of this block must send it again
+                queued[server].erase(dedup_key(call.hashes[i], call.chains[i]));
+                log->error("Fail uploading block with hash {} to server #{}. Skip.", call.hashes[i].hex(), server);
+            }
+        }
+        bytes_uploaded[server] += call.bytes;
+    }
+
+    if (in_flight[server].empty())
+    {
+        busy_time[server] += high_resolution_clock::now() - busy_since[server];
+    }
+}
+
+// collect every reply that has already arrived, from any server
+void UploadEngine::reap_ready()
+{
+    for (size_t server = 0; server < in_flight.size(); ++server)
+    {
+        while (!in_flight[server].empty() &&
+               in_flight[server].front().reply.wait_for(seconds(0)) == future_status::ready)
+        {
+            wait_oldest(server);
+        }
+    }
+}
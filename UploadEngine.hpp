@@ -0,0 +1,129 @@
+#ifndef UPLOADENGINE_HPP
+#define UPLOADENGINE_HPP
+
+#include <chrono>
+#include <deque>
+#include <future>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <utility>
+
+#include "rpc/client.h"
+
+#include "logger.hpp"
+#include "BlockCodec.hpp"
+#include "BlockHash.hpp"
+#include "LatencyTracker.hpp"
+
+using namespace std;
+
+/**
+ * Sends blocks to the SurfStoreServers in pipelined batches.
+ *
+ * Placement policies only decide which server(s) a block goes to and hand it
+ * to add(). Blocks are grouped per target server and shipped with a single
+ * store_blocks RPC once a server's batch reaches batch_bytes, so uploading a
+ * file costs a few round trips per server instead of one per block.
+ *
+ * Batches are sent with rpc::client::async_call, and up to window of them
+ * may be outstanding per server before add() waits for the oldest reply.
+ * Servers are therefore fed in parallel (both replicas of a block travel at
+ * the same time) and each WAN link stays busy while replies are in flight.
+ *
+ * With dedup on, a block is queued for a server at most once per run, and
+ * every batch first asks the server which of its blocks it already holds
+ * with has_blocks (protocol version 3). Only the missing ones are then sent
+ * with store_blocks, so re-uploading a mostly unchanged tree costs little
+ * more than its hashes.
+ *
+ * Blocks may arrive compressed (see BlockCodec.hpp). They are then sent
+ * with store_encoded_blocks (protocol version 4), which carries each
+ * block's codec next to it; otherwise every block must be NONE.
+ *
+ * A block may come with a chain of further servers to hold it. It is then
+ * sent to its server alone with store_chained_blocks (protocol version 6),
+ * which passes it on down the chain over the servers' own links, so the
+ * block leaves the uploader once however many copies are stored. The
+ * server replies once its own copy is stored, so a copy lost further down
+ * the chain is only logged by the server that failed to pass it on, and
+ * put back by the repairer. With dedup, a chained block is queued at most
+ * once per run for the same server and chain, and one its server already
+ * holds is not sent again: the server passes its own copy on with
+ * copy_blocks (protocol version 7; before that the block is sent anyway).
+ *
+ * The latency of every has_blocks reply is passed on to the LatencyTracker;
+ * batches that carry blocks take as long as their payload, not the RTT.
+ */
+class UploadEngine
+{
+  public:
+    UploadEngine(vector<rpc::client *> &t_clients, LatencyTracker &t_latency, size_t t_batch_bytes, size_t t_window,
+                 int t_protocol, bool t_dedup);
+
+    // queue a block, encoded with codec, for server, which passes it on to
+    // the servers in chain in turn; sends that server's batch once it is full
+    void add(int server, const BlockHash &hash, BlockCodec::Codec codec, const string &block,
+             const vector<int> &chain = vector<int>());
+
+    // send every partially filled batch and wait for all replies. Returns
+    // false if any block added since the previous finish() failed to upload.
+    bool finish();
+
+    // log the bytes uploaded to, and the achieved MB/s of, every server, and
+    // how much dedup saved
+    void report();
+
+  protected:
+    enum Call
+    {
+        STORE, // store_blocks or one of its successors
+        CHECK, // has_blocks, which keeps its batch until it knows what to send
+        COPY,  // copy_blocks of blocks the server already holds
+    };
+
+    struct InFlight
+    {
+        future<RPCLIB_MSGPACK::object_handle> reply;
+        chrono::high_resolution_clock::time_point sent;
+        vector<BlockHash> hashes;
+        size_t bytes;
+        Call call;
+        vector<pair<string, string>> batch; // CHECK only
+        string codecs;                      // CHECK only
+        vector<vector<int>> chains;
+    };
+
+    vector<rpc::client *> &clients;
+    LatencyTracker &latency;
+    size_t batch_bytes; // payload bytes per store_blocks call
+    size_t window;      // store_blocks calls outstanding per server
+    int protocol;       // negotiated with the servers, see Protocol.hpp
+    bool dedup;         // skip blocks the server already has; needs protocol version 3
+
+    vector<vector<pair<string, string>>> pending; // per server: (wire hash, block) pairs not sent yet
+    vector<vector<BlockHash>> pending_hashes;
+    vector<string> pending_codecs; // one BlockCodec::Codec byte per pending block
+    vector<vector<vector<int>>> pending_chains; // per pending block: the servers it is passed on to
+    vector<size_t> pending_bytes;
+    vector<deque<InFlight>> in_flight; // per server, oldest first
+    vector<unordered_set<string>> queued; // per server: every block added this run, see dedup_key()
+    bool success;
+
+    // per server throughput accounting; a server is "busy" from the moment a
+    // batch is sent while it had nothing in flight until its last reply
+    vector<size_t> bytes_uploaded;
+    vector<size_t> bytes_present;  // not sent: the server already had them
+    vector<size_t> bytes_repeated; // not sent: already added earlier in this run
+    vector<chrono::high_resolution_clock::duration> busy_time;
+    vector<chrono::high_resolution_clock::time_point> busy_since;
+
+    void send(int server);
+    void store(int server, vector<pair<string, string>> &batch, vector<BlockHash> &hashes, string &codecs,
+               vector<vector<int>> &chains, size_t bytes);
+    void copy(int server, vector<BlockHash> &hashes, vector<vector<int>> &chains, size_t bytes);
+    void wait_oldest(int server);
+    void reap_ready();
+};
+
+#endif // UPLOADENGINE_HPP
@@ -15,60 +15,21 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <time.h>
+#include <thread>
+#include <memory>
 
 #include "rpc/server.h"
 #include "rpc/rpc_error.h"
-#include "picosha2/picosha2.h"
 
 #include "logger.hpp"
 #include "Uploader.hpp"
+#include "Protocol.hpp"
+#include "LatencyTracker.hpp"
+#include "PlacementPolicy.hpp"
 
 using namespace std;
 using namespace std::chrono;
 
-float getstd(vector<int>& vec){
-    float var = 0;
-    float mean = accumulate(vec.begin(), vec.end(), 0.0)/vec.size(); 
-    
-    for(const auto& item : vec)
-    {
-      var += (item - mean) * (item - mean);
-    }
-    var /= vec.size();
-    return sqrt(var);
-}
-
-/**
- * Helper function to calculated RTT for the given server
- *
- * Compute, for every datacenter, the average of eight round-trip time measurements.
- * To estimate the round-trip time, simply time the latency of a ping() RPC call.
- *
- * See https://stackoverflow.com/a/783872 for helper function naming
- * See https://www.geeksforgeeks.org/measure-execution-time-function-cpp/ for timing statement exec time
- */
-float __calcSingleRTT(rpc::client * client, int index)
-{
-    auto log = logger();
-    vector<int> durations;
-    log->info("Calculating RTT for server #{}...", index);
-    // compute, for every datacenter, the average of eight round-trip time measurements.
-    for (int j = 0; j < 8; j++)
-    {
-        auto start = high_resolution_clock::now();
-        client->call("ping"); // time the latency of a ping() RPC call for RTT
-        auto stop = high_resolution_clock::now();
-        auto duration = duration_cast<milliseconds>(stop - start).count();
-        durations.push_back(duration);
-        log->error("RTT #{} = {}", j, duration);
-    }
-    float average = accumulate( durations.begin(), durations.end(), 0.0) / durations.size();
-    log->error("Average RTT is {} for server #{}", average, index);
-    log->info("RTT standard dev: {} milliseconds for server #{}", getstd(durations), index);
-
-    return average;
-}
-
 Uploader::Uploader(INIReader &t_config)
     : config(t_config)
 {
@@ -92,15 +53,135 @@ Uploader::Uploader(INIReader &t_config)
     }
     log->info("Using a block size of {}", blocksize);
 
+    // Read in the per-RPC batch budget; by default a batch holds 8 blocks
+    batch_bytes = (int)config.GetInteger("uploader", "batch_bytes", 8 * (long)blocksize);
+    if (batch_bytes <= 0)
+    {
+        log->error("Invalid batch size: {}", batch_bytes);
+        exit(EX_CONFIG);
+    }
+    log->info("Using a batch size of {} bytes", batch_bytes);
+
+    // Read in how many batches may be in flight to each server at once
+    window = (int)config.GetInteger("uploader", "window", 4);
+    if (window <= 0)
+    {
+        log->error("Invalid in-flight window: {}", window);
+        exit(EX_CONFIG);
+    }
+    log->info("Using an in-flight window of {} batches per server", window);
+
+    // Read in whether to skip blocks the servers already have
+    dedup = config.GetBoolean("uploader", "dedup", true);
+
+    // Read in how files are cut into blocks; content-defined chunks average
+    // blocksize bytes by default
+    chunking = config.Get("uploader", "chunking", "fixed");
+    if (chunking == "cdc")
+    {
+        cdc_avg_size = (int)config.GetInteger("uploader", "cdc_avg_size", blocksize);
+        cdc_min_size = (int)config.GetInteger("uploader", "cdc_min_size", cdc_avg_size / 4);
+        cdc_max_size = (int)config.GetInteger("uploader", "cdc_max_size", 8 * (long)cdc_avg_size);
+        if (cdc_min_size <= 0 || cdc_avg_size <= cdc_min_size || cdc_max_size <= cdc_avg_size)
+        {
+            log->error("Invalid chunk sizes: min {}, avg {}, max {}", cdc_min_size, cdc_avg_size, cdc_max_size);
+            exit(EX_CONFIG);
+        }
+        log->info("Using content-defined chunks of {} to {} bytes, {} on average", cdc_min_size, cdc_max_size, cdc_avg_size);
+    }
+    else if (chunking != "fixed")
+    {
+        log->error("Invalid chunking: {}", chunking);
+        exit(EX_CONFIG);
+    }
+
+    // Read in the SHA-256 implementation and how many threads run it
+    string engine_name = config.Get("uploader", "hash_engine", "auto");
+    if (!BlockHasher::parse(engine_name, hash_engine))
+    {
+        log->error("Invalid hash engine: {}", engine_name);
+        exit(EX_CONFIG);
+    }
+    if (!BlockHasher::supported(hash_engine))
+    {
+        log->error("Hash engine {} is not supported by this CPU", engine_name);
+        exit(EX_CONFIG);
+    }
+    hash_threads = (int)config.GetInteger("uploader", "hash_threads", max(1u, thread::hardware_concurrency()));
+    if (hash_threads <= 0)
+    {
+        log->error("Invalid number of hash threads: {}", hash_threads);
+        exit(EX_CONFIG);
+    }
+    log->info("Hashing with {} on {} threads", BlockHasher::name(hash_engine), hash_threads);
+
+    // Read in how to compress blocks; each block is only sent compressed if
+    // that makes it smaller
+    string compression_name = config.Get("uploader", "compression", "none");
+    if (!BlockCodec::parse(compression_name, compression))
+    {
+        log->error("Invalid compression: {}", compression_name);
+        exit(EX_CONFIG);
+    }
+    compression_level = (int)config.GetInteger("uploader", "compression_level", 3);
+    if (compression_level < 1 || compression_level > 19)
+    {
+        log->error("Invalid compression level: {}", compression_level);
+        exit(EX_CONFIG);
+    }
+    if (compression != BlockCodec::NONE)
+    {
+        log->info("Compressing blocks with {}", compression_name);
+    }
+
+    // Read in how many blocks of a file may be buffered at once; by default
+    // enough to keep every hashing thread's lanes busy twice over
+    size_t lanes = BlockHasher(hash_engine).lanes();
+    ring_blocks = (int)config.GetInteger("uploader", "ring_blocks", max((size_t)8, 2 * hash_threads * lanes));
+    if (ring_blocks <= 0)
+    {
+        log->error("Invalid number of ring blocks: {}", ring_blocks);
+        exit(EX_CONFIG);
+    }
+    log->info("Buffering up to {} blocks per file", ring_blocks);
+
+    // Read in how many pings time each server at startup, and how often to
+    // ping them all again while uploading
+    rtt_probes = (int)config.GetInteger("uploader", "rtt_probes", 8);
+    if (rtt_probes <= 0)
+    {
+        log->error("Invalid number of RTT probes: {}", rtt_probes);
+        exit(EX_CONFIG);
+    }
+    probe_interval_ms = config.GetInteger("uploader", "probe_interval_ms", 1000);
+    if (probe_interval_ms < 0)
+    {
+        log->error("Invalid probe interval: {}", probe_interval_ms);
+        exit(EX_CONFIG);
+    }
+
     // Read in the uploader's block placement policy
     policy = config.Get("uploader", "policy", "");
-    if (policy == "")
+    if (!PlacementPolicy::known(policy))
     {
         log->error("Invalid placement policy: {}", policy);
         exit(EX_CONFIG);
     }
     log->info("Using a block placement policy of {}", policy);
 
+    // Read in how many copies of each block the twochoices and rendezvous
+    // policies store
+    replicas = (int)config.GetInteger("uploader", "replicas", 2);
+    if (replicas <= 0)
+    {
+        log->error("Invalid number of replicas: {}", replicas);
+        exit(EX_CONFIG);
+    }
+
+    // Read in whether copies past the first are passed on by the servers
+    // rather than sent by us
+    chain_replication = config.GetBoolean("uploader", "chain_replication", false);
+
     num_servers = (int)config.GetInteger("ssd", "num_servers", -1);
     if (num_servers <= 0)
     {
@@ -109,6 +190,25 @@ Uploader::Uploader(INIReader &t_config)
     }
     log->info("Number of servers: {}", num_servers);
 
+    // Read in how many data and parity fragments the erasure policy cuts
+    // every block into; no two fragments of a block may share a server
+    erasure_data = (int)config.GetInteger("uploader", "erasure_data", 2);
+    erasure_parity = (int)config.GetInteger("uploader", "erasure_parity", 1);
+    if (erasure_data <= 0 || erasure_parity < 0 || erasure_data + erasure_parity > 255)
+    {
+        log->error("Invalid erasure code: {} data, {} parity fragments", erasure_data, erasure_parity);
+        exit(EX_CONFIG);
+    }
+    if (policy == ERASURE)
+    {
+        if (erasure_data + erasure_parity > num_servers)
+        {
+            log->error("{} erasure fragments do not fit on {} servers", erasure_data + erasure_parity, num_servers);
+            exit(EX_CONFIG);
+        }
+        log->info("Cutting blocks into {} data and {} parity fragments", erasure_data, erasure_parity);
+    }
+
     for (int i = 0; i < num_servers; ++i)
     {
         string servconf = config.Get("ssd", "server" + std::to_string(i), "");
@@ -193,33 +293,58 @@ void Uploader::upload()
         }
     }
 
-    vector<float> avg_durations;
+    // measure the RTT to every server at once, and keep measuring it
+    LatencyTracker latency(ssdhosts, ssdports, RPC_TIMEOUT);
+    latency.probe(rtt_probes);
+    latency.report();
+    if (probe_interval_ms > 0)
+    {
+        latency.start(milliseconds(probe_interval_ms));
+    }
+
+    // send raw hashes only if every server understands them
+    protocol = negotiate_protocol(clients);
+
+    if (dedup && protocol < 3)
+    {
+        log->error("Some servers do not support has_blocks, uploading every block");
+    }
 
-    // calc rtt for all servers
+    // decides where every block goes
+    ErasureCode code(erasure_data, erasure_parity);
+    if (policy == ERASURE)
+    {
+        log->info("Erasure coding with {}", ErasureCode::name(code.engine()));
+    }
+    vector<string> addresses;
     for (int i = 0; i < num_servers; ++i)
     {
-        avg_durations.push_back(__calcSingleRTT(clients[i], i));
+        addresses.push_back(ssdhosts[i] + ":" + std::to_string(ssdports[i]));
     }
+    unique_ptr<PlacementPolicy> placement(PlacementPolicy::create(policy, clients, addresses, latency, protocol, replicas, code));
 
-    // find local server index (element index with lowest value) and closest
-    // server index (element index with second lowest value)
-    int local_idx = -1, second_idx = -1;
-    float smallest = numeric_limits<float>::max(), second = numeric_limits<float>::max();
-
-    // find smallest and second smallest avg duration indices
-    for( size_t i = 0; i < avg_durations.size(); ++i){
-        if( avg_durations[i] <= smallest){
-            second = smallest;
-            smallest = avg_durations[i];
-            second_idx = local_idx;
-            local_idx = i;
-        } else if( avg_durations[i] < second){
-            second = avg_durations[i];
-            second_idx = i;
-        }
-    } // end for
+    if (chain_replication && protocol < 6)
+    {
+        log->error("Some servers do not support store_chained_blocks, uploading every copy ourselves");
+    }
+    bool chain = chain_replication && protocol >= 6;
 
-    int far_idx = max_element(avg_durations.begin(), avg_durations.end()) - avg_durations.begin();
+    // groups blocks per target server into pipelined store_blocks batches
+    UploadEngine engine(clients, latency, batch_bytes, window, protocol, dedup && protocol >= 3);
+
+    // reads and hashes each file a block at a time, ahead of the uploads
+    BlockHasher hasher(hash_engine);
+    unique_ptr<Chunker> chunker;
+    if (chunking == "cdc")
+    {
+        chunker.reset(new Chunker(cdc_min_size, cdc_avg_size, cdc_max_size));
+    }
+    if (compression != BlockCodec::NONE && protocol < 4)
+    {
+        log->error("Some servers do not support compressed blocks, uploading them uncompressed");
+    }
+    BlockCodec block_codec(protocol >= 4 ? compression : BlockCodec::NONE, compression_level);
+    BlockPipeline pipeline(blocksize, ring_blocks, hasher, hash_threads, chunker.get(), block_codec);
 
     // The uploader program will process each file in the base directory.
     // To process a file, the uploader will break the file into blocks, and store
@@ -233,45 +358,45 @@ void Uploader::upload()
         // skip any file starting with .
         if (filename[0] == '.') { continue; }
 
-        list<string> new_hashlist; // create a hashlist for each file
-        list<string> blocks = get_blocks_from_file(filename);
-
-        // for each file, compute that file’s hash list.
-        for (const string &block : blocks)
-        {
-            string blockhash = picosha2::hash256_hex_string(block); // compute hash for each block
-            new_hashlist.push_back(blockhash);
-        }
+        vector<BlockHash> new_hashlist; // create a hashlist for each file
+        placement->refresh();
 
         log->info("Uploading {} file blocks...", filename);
 
-        bool block_upload_success = false;
-
         // The client should upload the blocks corresponding to this file to the server,
         // then update the server with the new FileInfo.
-        // store each block according to the the placement policy.
-        // can't use switch case: See https://stackoverflow.com/a/650218
+        // Blocks are read, hashed, and stored according to the placement
+        // policy as they stream through the pipeline, so a file is never
+        // held in memory as a whole.
         srand(time(NULL)); // initialize random seed with time
-        if (policy == RAND)
-        {
-            block_upload_success = upload_data_rand(clients, new_hashlist, blocks);
-        }
-        else if (policy == TWO_RAND)
-        {
-            block_upload_success = upload_data_two_rand(clients, new_hashlist, blocks);
-        }
-        else if (policy == LOCAL)
-        {
-            block_upload_success = upload_data_local(clients, local_idx, new_hashlist, blocks);
-        }
-        else if (policy == LOCAL_CLOSE)
-        {
-            block_upload_success = upload_data_local_close(clients, local_idx, second_idx, new_hashlist, blocks);
-        }
-        else if (policy == LOCAL_FAR)
-        {
-            block_upload_success = upload_data_local_far(clients, local_idx, far_idx, new_hashlist, blocks);
-        }
+        vector<PlacementPolicy::Fragment> fragments;
+        bool read_success = pipeline.run(base_dir + "/" + filename, [&](const BlockHash &hash, BlockCodec::Codec codec, const string &block) {
+            new_hashlist.push_back(hash); // for each file, compute that file’s hash list.
+            if (placement->split(hash, codec, block, fragments))
+            {
+                // fragments carry the block's codec in their header
+                for (const PlacementPolicy::Fragment &fragment : fragments)
+                {
+                    engine.add(fragment.server, fragment.hash, BlockCodec::NONE, fragment.data);
+                }
+                return;
+            }
+            vector<int> targets = placement->place(hash, block.size());
+            if (chain && targets.size() > 1)
+            {
+                // the closest target gets the block from us and passes it on
+                auto closest = min_element(targets.begin(), targets.end(),
+                                           [&](int a, int b) { return latency.srtt_us(a) < latency.srtt_us(b); });
+                iter_swap(targets.begin(), closest);
+                engine.add(targets[0], hash, codec, block, vector<int>(targets.begin() + 1, targets.end()));
+                return;
+            }
+            for (int server : targets)
+            {
+                engine.add(server, hash, codec, block);
+            }
+        });
+        bool block_upload_success = engine.finish() && read_success;
 
         if (!block_upload_success)
         {
@@ -281,7 +406,7 @@ void Uploader::upload()
 
         // After files are created they are never deleted or modified,
         // so the version number for files will always be 1.
-        FileInfo new_finfo = make_tuple(1, new_hashlist);
+        PackedFileInfo new_finfo = make_tuple(1, BlockHash::pack(new_hashlist));
 
         // Once the blocks for a file
         // have been uploaded to the appropriate blockstore or blockstores, the uploader
@@ -289,7 +414,8 @@ void Uploader::upload()
         for (int i = 0; i < num_servers; ++i)
         {
             log->info("Uploading {} file info to server #{} ...", filename, i);
-            bool finfo_update_success = clients[i]->call("update_file", filename, new_finfo).as<bool>(); // update the server with the new FileInfo.
+            // update the server with the new FileInfo.
+            bool finfo_update_success = clients[i]->call("update_file_v2", filename, new_finfo).as<bool>();
             if (!finfo_update_success)
             {
                 log->error("Fail updating {} file info. Skip.", filename);
@@ -298,6 +424,11 @@ void Uploader::upload()
 
     } // end while iterating over files in dir
 
+    pipeline.report();
+    engine.report();
+    latency.stop();
+    latency.report();
+
     // Delete the clients
     for (int i = 0; i < num_servers; ++i)
     {
@@ -305,210 +436,3 @@ void Uploader::upload()
         delete clients[i];
     }
 }
-
-/**
- * Get the data blocks from the file given by filename
- */
-list<string> Uploader::get_blocks_from_file(string filename)
-{
-    auto log = logger();
-    log->info("getting data blocks from file '{}'", filename);
-
-    list<string> blocks;
-    ifstream is(base_dir + "/" + filename, ifstream::binary); // read in file content
-
-    if (!is)
-    {
-        // handle file permission error?
-        log->error("error reading file '{}'", filename);
-        return blocks;
-    } // Sanity check: no permission or corrupt file
-
-    char *blockbuffer = new char[blocksize]; // get each chunk of file content, chunksize = blocksize
-
-    while (!is.eof())
-    {
-        is.read(blockbuffer, blocksize);        // only read in next blocksize bytes for each block
-        string block(blockbuffer, is.gcount()); // support '\0' element in it
-        blocks.push_back(block);
-    }
-
-    delete blockbuffer;
-    return blocks;
-}
-
-/**
- * For the random policy, when a client uploads a file to the cloud, it simply
- * chooses, for each block, a random datacenter and stores the block there.
- */
-bool Uploader::upload_data_rand(vector<rpc::client *> &clients, list<string> &hashlist, list<string> &blocklist)
-{
-    auto log = logger();
-    bool block_upload_success = true;
-    auto hashlist_it = hashlist.begin(); // same length as new_blocks
-    auto blocks_it = blocklist.begin();  // same length as hashlist
-
-    // iterate over each block
-    while (hashlist_it != hashlist.end() && blocks_it != blocklist.end())
-    {
-        // it simply chooses, for each block, a random datacenter and stores the block there.
-        int target_serv_id = rand() % num_servers;
-        bool this_block_upload_success = clients[target_serv_id]->call("store_block", *hashlist_it, *blocks_it).as<bool>();
-
-        if (!this_block_upload_success)
-        {
-            block_upload_success = false;
-            log->error("Fail uploading block with hash {} to server #{}. Skip.", *hashlist_it, target_serv_id);
-        }
-
-        ++hashlist_it; ++blocks_it;
-    }
-    return block_upload_success;
-}
-
-/**
- * For tworandom, the client chooses two datacenters at random for each block,
- * and stores one copy of the block in the first datacenter, and a second copy
- * of that block in the second datacenter. Note for tworandom: make sure that
- * you don’t store two copies of the same block on the same server–you must
- * ensure that two different random datacenters are selected.
- */
-bool Uploader::upload_data_two_rand(vector<rpc::client *> &clients, list<string> &hashlist, list<string> &blocklist)
-{
-    auto log = logger();
-    bool block_upload_success = true;
-    auto hashlist_it = hashlist.begin(); // same length as new_blocks
-    auto blocks_it = blocklist.begin();  // same length as hashlist
-
-    // iterate over each block
-    while (hashlist_it != hashlist.end() && blocks_it != blocklist.end())
-    {
-        int target_serv_id_1 = rand() % num_servers;
-        int target_serv_id_2 = rand() % num_servers;
-
-        // make sure two server ids are chose to store two copies
-        while (target_serv_id_1 == target_serv_id_2)
-        {
-            target_serv_id_2 = rand() % num_servers;
-        }
-
-        bool this_block_upload_success_1 = clients[target_serv_id_1]->call("store_block", *hashlist_it, *blocks_it).as<bool>();
-        bool this_block_upload_success_2 = clients[target_serv_id_2]->call("store_block", *hashlist_it, *blocks_it).as<bool>();
-
-        if (!this_block_upload_success_1)
-        {
-            block_upload_success = false;
-            log->error("Fail uploading block with hash {} to first server #{}. Skip.", *hashlist_it, target_serv_id_1);
-        }
-
-        if (!this_block_upload_success_2)
-        {
-            block_upload_success = false;
-            log->error("Fail uploading block with hash {} to second server #{}. Skip.", *hashlist_it, target_serv_id_2);
-        }
-
-        ++hashlist_it; ++blocks_it;
-    }
-
-    return block_upload_success;
-}
-
-/**
- * For the local policy, the client simply stores all the blocks of the file on
- * the blockstore running on the same datacenter as the client (localhost).
- * just pick the server with the smallest RTT (don't check if it is equal to
- * zero because it might be non-zero (but close to zero) due to protocol overhead, etc.
- * See https://groups.google.com/a/ucsd.edu/forum/#!searchin/crs-cse124_wi19_a00-wi19/localhost|sort:date/crs-cse124_wi19_a00-wi19/kVkRrY5tYvg/5dHxsp4ABwAJ
- */
-bool Uploader::upload_data_local(vector<rpc::client *> &clients, int local_idx, list<string> &hashlist, list<string> &blocklist)
-{
-    auto log = logger();
-    bool block_upload_success = true;
-    auto hashlist_it = hashlist.begin(); // same length as new_blocks
-    auto blocks_it = blocklist.begin();  // same length as hashlist
-    vector<float> avg_durations;
-
-    // iterate over each block
-    while (hashlist_it != hashlist.end() && blocks_it != blocklist.end())
-    {
-        bool this_block_upload_success = clients[local_idx]->call("store_block", *hashlist_it, *blocks_it).as<bool>();
-
-        if (!this_block_upload_success)
-        {
-            block_upload_success = false;
-            log->error("Fail uploading block with hash {} to local server #{}. Skip.", *hashlist_it, local_idx);
-        }
-
-        ++hashlist_it; ++blocks_it;
-    }
-    return block_upload_success;
-}
-
-/**
- * For the localclosest policy, the client stores two copies of the block–one on
- * the local blockstore, and a second copy of that block on whichever other
- * datacenter has the smallest average round-trip time (RTT) to the client.
- */
-bool Uploader::upload_data_local_close(vector<rpc::client *> &clients, int local_idx, int second_idx, list<string> &hashlist, list<string> &blocklist)
-{
-    auto log = logger();
-    bool block_upload_success = true;
-    auto hashlist_it = hashlist.begin(); // same length as new_blocks
-    auto blocks_it = blocklist.begin();  // same length as hashlist
-
-    // iterate over each block
-    while (hashlist_it != hashlist.end() && blocks_it != blocklist.end())
-    {
-        bool this_block_upload_success_local = clients[local_idx]->call("store_block", *hashlist_it, *blocks_it).as<bool>();
-        bool this_block_upload_success_second = clients[second_idx]->call("store_block", *hashlist_it, *blocks_it).as<bool>();
-
-        if (!this_block_upload_success_local)
-        {
-            block_upload_success = false;
-            log->error("Fail uploading block with hash {} to local server #{}. Skip.", *hashlist_it, local_idx);
-        }
-
-        if (!this_block_upload_success_second)
-        {
-            block_upload_success = false;
-            log->error("Fail uploading block with hash {} to second closest server #{}. Skip.", *hashlist_it, second_idx);
-        }
-
-        ++hashlist_it; ++blocks_it;
-    } // end while
-
-    return block_upload_success;
-}
-
-/**
- * localfarthest is the opposite–the client stores a copy of the block on localhost,
- * and a second copy of the block on the server that has the highest RTT from
- * the client (i.e., is likely farthest away).
- */
-bool Uploader::upload_data_local_far(vector<rpc::client *> &clients, int local_idx, int far_idx, list<string> &hashlist, list<string> &blocklist)
-{
-    auto log = logger();
-    bool block_upload_success = true;
-    auto hashlist_it = hashlist.begin(); // same length as new_blocks
-    auto blocks_it = blocklist.begin();  // same length as hashlist
-
-    // iterate over each block
-    while (hashlist_it != hashlist.end() && blocks_it != blocklist.end())
-    {
-        bool this_block_upload_success_local = clients[local_idx]->call("store_block", *hashlist_it, *blocks_it).as<bool>();
-        bool this_block_upload_success_far = clients[far_idx]->call("store_block", *hashlist_it, *blocks_it).as<bool>();
-        if (!this_block_upload_success_local)
-        {
-            block_upload_success = false;
-            log->error("Fail uploading block with hash {} to local server #{}. Skip.", *hashlist_it, local_idx);
-        }
-        if (!this_block_upload_success_far)
-        {
-            block_upload_success = false;
-            log->error("Fail uploading block with hash {} to furthest server #{}. Skip.", *hashlist_it, far_idx);
-        }
-
-        ++hashlist_it; ++blocks_it;
-    }
-    return block_upload_success;
-}
@@ -8,6 +8,9 @@
 #include "rpc/client.h"
 
 #include "SurfStoreTypes.hpp"
+#include "UploadEngine.hpp"
+#include "BlockPipeline.hpp"
+#include "LatencyTracker.hpp"
 #include "logger.hpp"
 
 using namespace std;
@@ -26,20 +29,30 @@ class Uploader
 
     string base_dir;
     int blocksize;
-    string policy; // See SurfStoreType.hpp: one of "random", "tworandom", "local", "localclosest", "localfarthest"
+    int batch_bytes; // payload bytes per store_blocks call
+    int window;      // store_blocks calls in flight per server
+    int protocol;    // negotiated with the servers, see Protocol.hpp
+    bool dedup;      // only send blocks a server does not have yet
+    int ring_blocks; // block buffers shared by the read, hash and upload stages
+    BlockHasher::Engine hash_engine; // see BlockHasher.hpp
+    BlockCodec::Codec compression;   // see BlockCodec.hpp
+    int compression_level;
+    string chunking; // "fixed" blocksize blocks or "cdc", see Chunker.hpp
+    int cdc_min_size;
+    int cdc_avg_size;
+    int cdc_max_size;
+    int hash_threads;
+    int rtt_probes;         // pings per server at startup, see LatencyTracker.hpp
+    long probe_interval_ms; // between background pings; 0 for none
+    string policy; // See PlacementPolicy.hpp: one of "random", "tworandom", "local", "localclosest", "localfarthest", "twochoices", "erasure", "rendezvous"
+    int replicas;  // copies of each block, for policies that do not fix it
+    int erasure_data;   // fragments a block is cut into by the erasure policy, see ErasureCode.hpp
+    int erasure_parity; // parity fragments added to them
+    bool chain_replication; // servers pass copies on to each other, see UploadEngine.hpp
 
     int num_servers;
     vector<string> ssdhosts;
     vector<int> ssdports;
-
-    // helper functions to get/set blocks to/from local files
-    list<string> get_blocks_from_file(string filename);
-    // upload functions of various policies
-    bool upload_data_rand(vector<rpc::client *>& clients, list<string>& hashlist, list<string>& blocklist);
-    bool upload_data_two_rand(vector<rpc::client *>& clients, list<string>& hashlist, list<string>& blocklist);
-    bool upload_data_local(vector<rpc::client *> &clients, int local_idx, list<string> &hashlist, list<string> &blocklist);
-    bool upload_data_local_close(vector<rpc::client *> &clients, int local_idx, int second_idx, list<string> &hashlist, list<string> &blocklist);
-    bool upload_data_local_far(vector<rpc::client *> &clients, int local_idx, int far_idx, list<string> &hashlist, list<string> &blocklist);
 };
 
 #endif // UPLOADER_HPP
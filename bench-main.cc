@@ -0,0 +1,376 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <string>
+#include <vector>
+#include <memory>
+#include <sysexits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "logger.hpp"
+#include "BlockStore.hpp"
+#include "LogBlockStore.hpp"
+#include "TieredBlockStore.hpp"
+#include "ArenaBlockStore.hpp"
+#include "ShardedMap.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * Micro-benchmarks for the ssd block storage engines.
+ *
+ * Inserts num_blocks blocks of blocksize random bytes into the memory engine
+ * and into a log engine rooted at data_dir, reporting the insert throughput
+ * of each, then reopens the log engine to time index recovery.
+ *
+ * It then has num_readers threads serve random blocks from each engine the
+ * way get_block does, once through the old copying path and once through
+ * the zero-copy view path, reporting CPU seconds per GB served and p99
+ * latency per request.
+ *
+ * The tiered engine gets a quarter of the blocks' size as max_memory, and
+ * serves reads of which 80% go to a tenth of the blocks, reporting its RAM
+ * hit ratio and demotions.
+ *
+ * The arena and memory engines are then each filled with index_blocks
+ * small blocks, reporting the memory each spends per block beyond the
+ * payload, and the time a random lookup takes.
+ *
+ * Finally it compares looking up num_blocks keys as 64-char hex strings, as
+ * protocol version 1 did, with looking them up as binary BlockHashes, and
+ * the size of a FileInfo hash list in either encoding.
+ */
+
+// a well-mixed key, like the SHA-256 hashes the uploader produces
+static BlockHash fake_hash(size_t i)
+{
+    BlockHash hash;
+    uint64_t x = i;
+    for (size_t word = 0; word < BlockHash::SIZE / sizeof(x); ++word)
+    {
+        // splitmix64
+        x += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z ^= z >> 31;
+        memcpy(hash.bytes + word * sizeof(z), &z, sizeof(z));
+    }
+    return hash;
+}
+
+static double seconds_since(high_resolution_clock::time_point start)
+{
+    return duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1e6;
+}
+
+static void bench_insert(const string &name, BlockStore &store, const vector<string> &blocks, size_t num_blocks)
+{
+    auto log = logger();
+    size_t bytes = 0;
+
+    auto start = high_resolution_clock::now();
+    for (size_t i = 0; i < num_blocks; ++i)
+    {
+        const string &block = blocks[i % blocks.size()];
+        store.store(fake_hash(i), block, BlockCodec::NONE);
+        bytes += block.size();
+    }
+    double secs = seconds_since(start);
+
+    log->info("{} insert: {} blocks in {:.3f} s, {:.0f} blocks/s, {:.1f} MB/s",
+              name, num_blocks, secs, num_blocks / secs, bytes / secs / 1e6);
+}
+
+// user + system CPU seconds consumed by the whole process so far
+static double cpu_seconds()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/**
+ * Serve reads_per_reader random blocks on each of num_readers threads.
+ * Every request ends with the payload in a per-thread "response buffer".
+ *
+ * The copying path mirrors the old get_block: the block is materialized as
+ * a std::string, copied into the msgpack zone, then packed into the buffer.
+ * The zero-copy path packs straight from the store's view.
+ */
+static void bench_read(const string &name, BlockStore &store, size_t num_blocks,
+                       int num_readers, size_t reads_per_reader, bool zero_copy)
+{
+    auto log = logger();
+    vector<vector<double>> latencies(num_readers);
+    vector<size_t> bytes(num_readers, 0);
+    vector<thread> readers;
+
+    double cpu_start = cpu_seconds();
+    auto start = high_resolution_clock::now();
+    for (int r = 0; r < num_readers; ++r)
+    {
+        readers.push_back(thread([&, r]() {
+            mt19937_64 rng(r);
+            string response;
+            for (size_t i = 0; i < reads_per_reader; ++i)
+            {
+                BlockHash hash = fake_hash(rng() % num_blocks);
+                auto t0 = high_resolution_clock::now();
+                if (zero_copy)
+                {
+                    BlockView view;
+                    store.get_view(hash, view);
+                    response.assign(view.data, view.length);
+                }
+                else
+                {
+                    string data;
+                    BlockCodec::Codec codec;
+                    store.get(hash, data, codec);
+                    string zone(data);
+                    response.assign(zone);
+                }
+                latencies[r].push_back(duration_cast<nanoseconds>(high_resolution_clock::now() - t0).count() / 1e3);
+                bytes[r] += response.size();
+            }
+        }));
+    }
+    for (thread &t : readers)
+    {
+        t.join();
+    }
+    double secs = seconds_since(start);
+    double cpu = cpu_seconds() - cpu_start;
+
+    vector<double> all;
+    size_t total_bytes = 0;
+    for (int r = 0; r < num_readers; ++r)
+    {
+        all.insert(all.end(), latencies[r].begin(), latencies[r].end());
+        total_bytes += bytes[r];
+    }
+    sort(all.begin(), all.end());
+    double p99 = all.empty() ? 0 : all[min(all.size() - 1, all.size() * 99 / 100)];
+
+    log->info("{} read ({}, {} readers): {:.1f} MB/s, {:.3f} CPU s/GB, p99 {:.1f} us",
+              name, zero_copy ? "zero-copy" : "copy", num_readers,
+              total_bytes / secs / 1e6, cpu / (total_bytes / 1e9), p99);
+}
+
+/**
+ * Read blocks with a skew, 80% of reads going to the first tenth of them,
+ * and report how the tiered engine's RAM tier held up.
+ */
+static void bench_tiered(TieredBlockStore &store, size_t num_blocks, size_t reads)
+{
+    auto log = logger();
+    mt19937_64 rng(3);
+    size_t hot = max((size_t)1, num_blocks / 10);
+
+    auto start = high_resolution_clock::now();
+    string data;
+    BlockCodec::Codec codec;
+    for (size_t i = 0; i < reads; ++i)
+    {
+        size_t idx = rng() % 10 < 8 ? rng() % hot : rng() % num_blocks;
+        store.get(fake_hash(idx), data, codec);
+    }
+    double secs = seconds_since(start);
+
+    map<string, uint64_t> stats = store.stats();
+    uint64_t hits = stats["ram_hits"] + stats["disk_hits"];
+    log->info("tiered read: {} skewed reads in {:.3f} s, {:.1f}% from RAM, {:.1f} of {:.1f} MB resident, "
+              "{} demotions, {} promotions",
+              reads, secs, hits > 0 ? 100.0 * stats["ram_hits"] / hits : 0.0, stats["resident_bytes"] / 1e6,
+              stats["max_memory"] / 1e6, stats["demotions"], stats["promotions"]);
+}
+
+// resident set size of the process in bytes
+static uint64_t resident_bytes()
+{
+    unsigned long size = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL)
+    {
+        if (fscanf(statm, "%lu %lu", &size, &resident) != 2)
+        {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Store num_blocks blocks of payload bytes each, and report what the store
+ * costs in memory beyond the payloads, per block, going by the growth of
+ * the resident set. Then look random blocks up through get_view.
+ */
+static void bench_index(const string &name, BlockStore &store, size_t num_blocks, size_t payload)
+{
+    auto log = logger();
+    string block(payload, 'x');
+
+    uint64_t before = resident_bytes();
+    auto start = high_resolution_clock::now();
+    for (size_t i = 0; i < num_blocks; ++i)
+    {
+        memcpy(&block[0], &i, min(sizeof(i), payload));
+        store.store(fake_hash(i), block, BlockCodec::NONE);
+    }
+    double insert_secs = seconds_since(start);
+    double overhead = ((double)resident_bytes() - before) / num_blocks - payload;
+
+    mt19937_64 rng(11);
+    size_t lookups = 4 * num_blocks;
+    size_t found = 0;
+    start = high_resolution_clock::now();
+    for (size_t i = 0; i < lookups; ++i)
+    {
+        BlockView view;
+        found += store.get_view(fake_hash(rng() % num_blocks), view);
+    }
+    double secs = seconds_since(start);
+
+    log->info("{} index: {} blocks of {} bytes, {:.0f} bytes of overhead per block, "
+              "{:.0f} ns per insert, {:.0f} ns per lookup",
+              name, num_blocks, payload, overhead, insert_secs * 1e9 / num_blocks, secs * 1e9 / max((size_t)1, found));
+}
+
+/**
+ * Look up every key of a num_blocks-entry ShardedMap, keyed like the
+ * server's block index, once with hex string keys and once with BlockHash
+ * keys, in random order.
+ */
+template <typename K>
+static void bench_lookup(const string &name, const vector<K> &keys)
+{
+    auto log = logger();
+    ShardedMap<K, size_t> index;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        index.insert(keys[i], i);
+    }
+
+    vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    shuffle(order.begin(), order.end(), mt19937_64(7));
+
+    size_t found = 0;
+    auto start = high_resolution_clock::now();
+    for (int round = 0; round < 4; ++round)
+    {
+        for (size_t i : order)
+        {
+            found += index.contains(keys[i]);
+        }
+    }
+    double secs = seconds_since(start);
+
+    log->info("{} lookup: {} keys, {:.0f} ns per lookup", name, keys.size(), secs * 1e9 / found);
+}
+
+int main(int argc, char **argv)
+{
+    initLogging();
+    auto log = logger();
+
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " [empty_data_dir] [num_blocks] [blocksize] [num_readers] [index_blocks]" << endl;
+        return EX_USAGE;
+    }
+
+    string data_dir = argv[1];
+    size_t num_blocks = argc > 2 ? strtoul(argv[2], NULL, 10) : 1024;
+    size_t blocksize = argc > 3 ? strtoul(argv[3], NULL, 10) : 1048576;
+    int num_readers = argc > 4 ? atoi(argv[4]) : 4;
+    size_t index_blocks = argc > 5 ? strtoul(argv[5], NULL, 10) : 1048576;
+    size_t reads_per_reader = 2 * num_blocks;
+
+    // a small pool of random payloads, reused round-robin
+    mt19937_64 rng(42);
+    vector<string> blocks(16, string(blocksize, '\0'));
+    for (string &block : blocks)
+    {
+        for (char &c : block)
+        {
+            c = (char)rng();
+        }
+    }
+
+    {
+        MemoryBlockStore memory;
+        bench_insert("memory", memory, blocks, num_blocks);
+        bench_read("memory", memory, num_blocks, num_readers, reads_per_reader, false);
+        bench_read("memory", memory, num_blocks, num_readers, reads_per_reader, true);
+    }
+
+    {
+        LogBlockStore disk(data_dir, 256 * 1024 * 1024, false);
+        bench_insert("log", disk, blocks, num_blocks);
+    }
+
+    auto start = high_resolution_clock::now();
+    LogBlockStore reopened(data_dir, 256 * 1024 * 1024, false);
+    log->info("log recovery: {} blocks in {:.3f} s", reopened.size(), seconds_since(start));
+
+    bench_read("log", reopened, num_blocks, num_readers, reads_per_reader, false);
+    bench_read("log", reopened, num_blocks, num_readers, reads_per_reader, true);
+
+    {
+        TieredBlockStore tiered(max((size_t)1, num_blocks * blocksize / 4), data_dir + "/tiered", 256 * 1024 * 1024, false);
+        bench_insert("tiered", tiered, blocks, num_blocks);
+        bench_tiered(tiered, num_blocks, reads_per_reader * num_readers);
+    }
+
+    {
+        ArenaBlockStore arena(64 * 1024 * 1024);
+        bench_insert("arena", arena, blocks, num_blocks);
+        bench_read("arena", arena, num_blocks, num_readers, reads_per_reader, false);
+        bench_read("arena", arena, num_blocks, num_readers, reads_per_reader, true);
+    }
+
+    // the arena goes first: its slabs go back to the OS when it is
+    // destroyed, while freed heap blocks would make the memory engine's
+    // growth look smaller than it is
+    {
+        ArenaBlockStore arena(64 * 1024 * 1024);
+        bench_index("arena", arena, index_blocks, 64);
+    }
+    {
+        MemoryBlockStore memory;
+        bench_index("memory", memory, index_blocks, 64);
+    }
+
+    vector<string> hex_keys;
+    vector<BlockHash> binary_keys;
+    for (size_t i = 0; i < num_blocks; ++i)
+    {
+        binary_keys.push_back(fake_hash(i));
+        hex_keys.push_back(binary_keys.back().hex());
+    }
+    bench_lookup("hex string", hex_keys);
+    bench_lookup("BlockHash", binary_keys);
+
+    // a hex hash is a str 8 of 64 bytes (66 on the wire) and, in memory, a
+    // std::string plus its heap buffer; a packed list is 32 bytes per hash
+    // in one bin 32
+    size_t hex_wire = num_blocks * (2 + 2 * BlockHash::SIZE) + 5;
+    size_t hex_memory = num_blocks * (sizeof(string) + 2 * BlockHash::SIZE + 1);
+    size_t packed = num_blocks * BlockHash::SIZE + 5;
+    log->info("hash list of {} blocks: {} bytes on the wire, {} in memory as hex; {} bytes packed",
+              num_blocks, hex_wire, hex_memory, packed);
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <sysexits.h>
+#include <stdlib.h>
+
+#include "inih/INIReader.h"
+
+#include "logger.hpp"
+#include "BlockHasher.hpp"
+#include "Chunker.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * Micro-benchmark for content-defined chunking.
+ *
+ * Makes a file of file_mb random bytes and two edited copies of it: one with
+ * a few bytes inserted near the start, and one with a byte overwritten in
+ * 16 random places. Every version is cut into fixed [uploader] blocksize
+ * blocks, and into content-defined chunks with the configured cdc_* sizes.
+ * For each split it reports how fast the original is cut and hashed, and the
+ * dedup ratio: the share of an edited copy's bytes in blocks the original
+ * already has, which the uploader would not need to send again.
+ */
+
+// cut data into [offset, length) pieces, fixed size when chunker is nullptr
+static vector<pair<size_t, size_t>> split(const string &data, size_t blocksize, const Chunker *chunker)
+{
+    vector<pair<size_t, size_t>> pieces;
+    for (size_t offset = 0; offset < data.size();)
+    {
+        size_t len = chunker ? chunker->cut((const uint8_t *)data.data() + offset, data.size() - offset)
+                             : min(blocksize, data.size() - offset);
+        pieces.push_back(make_pair(offset, len));
+        offset += len;
+    }
+    return pieces;
+}
+
+static unordered_set<BlockHash> hash_pieces(const BlockHasher &hasher, const string &data,
+                                            const vector<pair<size_t, size_t>> &pieces)
+{
+    unordered_set<BlockHash> hashes;
+    for (auto const &piece : pieces)
+    {
+        BlockHash hash;
+        hasher.hash(data.substr(piece.first, piece.second), hash);
+        hashes.insert(hash);
+    }
+    return hashes;
+}
+
+static void bench(const string &name, size_t blocksize, const Chunker *chunker,
+                  const string &original, const vector<pair<string, string>> &edits)
+{
+    auto log = logger();
+    BlockHasher hasher(BlockHasher::detect());
+
+    auto start = high_resolution_clock::now();
+    vector<pair<size_t, size_t>> pieces = split(original, blocksize, chunker);
+    double cut_secs = duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1e6;
+    unordered_set<BlockHash> known = hash_pieces(hasher, original, pieces);
+    double secs = duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1e6;
+
+    log->info("{}: {} blocks of {:.0f} bytes on average; cutting took {:.3f} s, cutting and hashing {:.0f} MB/s",
+              name, pieces.size(), (double)original.size() / pieces.size(), cut_secs, original.size() / secs / 1e6);
+    for (auto const &edit : edits)
+    {
+        const string &data = edit.second;
+        size_t reused = 0;
+        for (auto const &piece : split(data, blocksize, chunker))
+        {
+            BlockHash hash;
+            hasher.hash(data.substr(piece.first, piece.second), hash);
+            if (known.count(hash))
+            {
+                reused += piece.second;
+            }
+        }
+        log->info("{}, {}: dedup ratio {:.1f}%", name, edit.first, 100.0 * reused / data.size());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    initLogging();
+    auto log = logger();
+
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " [config_file] [file_mb]" << endl;
+        return EX_USAGE;
+    }
+
+    INIReader config(argv[1]);
+    if (config.ParseError() < 0)
+    {
+        cerr << "Error parsing config file " << argv[1] << endl;
+        return EX_CONFIG;
+    }
+
+    long blocksize = config.GetInteger("uploader", "blocksize", -1);
+    if (blocksize <= 0)
+    {
+        log->error("Invalid block size: {}", blocksize);
+        return EX_CONFIG;
+    }
+    long avg = config.GetInteger("uploader", "cdc_avg_size", blocksize);
+    long min_size = config.GetInteger("uploader", "cdc_min_size", avg / 4);
+    long max_size = config.GetInteger("uploader", "cdc_max_size", 8 * avg);
+    size_t file_mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+
+    mt19937_64 rng(42);
+    string original(file_mb * 1000000, '\0');
+    for (char &c : original)
+    {
+        c = (char)rng();
+    }
+
+    vector<pair<string, string>> edits;
+    string inserted = original;
+    inserted.insert(min((size_t)1000, inserted.size()), "inserted bytes");
+    edits.push_back(make_pair("insert near start", inserted));
+    string overwritten = original;
+    for (int i = 0; i < 16 && !overwritten.empty(); ++i)
+    {
+        overwritten[rng() % overwritten.size()] ^= 1;
+    }
+    edits.push_back(make_pair("16 overwrites", overwritten));
+
+    Chunker chunker(min_size, avg, max_size);
+    bench("fixed", blocksize, nullptr, original, edits);
+    bench("cdc", blocksize, &chunker, original, edits);
+
+    return 0;
+}
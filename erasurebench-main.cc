@@ -0,0 +1,195 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <sysexits.h>
+#include <stdlib.h>
+
+#include "inih/INIReader.h"
+
+#include "logger.hpp"
+#include "ErasureCode.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * Micro-benchmark for the erasure placement policy.
+ *
+ * Cuts total_mb of random blocks of the configured [uploader] blocksize into
+ * erasure_data + erasure_parity fragments with every engine this CPU
+ * supports, rebuilds them with the first erasure_parity fragments missing
+ * (the worst case, as data fragments are otherwise copied as they are), and
+ * reports GB/s of blocks. Every rebuilt block is checked against the
+ * original.
+ *
+ * It then compares what a block costs against tworandom's two copies:
+ * bytes uploaded and stored, and servers that may be lost. Given the RTT of
+ * every server in milliseconds, it also works out how long the first reply
+ * takes for a small block on average: the closer of two random holders for
+ * tworandom, the erasure_data-th fastest of the fragments' servers for
+ * erasure.
+ */
+
+// fragments and blocks come back sized by a first pass, so that the timed
+// pass reuses their buffers the way the uploader and downloader do
+static double bench_encode(const ErasureCode &code, const vector<string> &blocks, vector<vector<string>> &fragments)
+{
+    fragments.resize(blocks.size());
+    auto start = high_resolution_clock::now();
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        code.encode(blocks[i], BlockCodec::NONE, fragments[i]);
+    }
+    double secs = duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1e6;
+    return blocks.size() * blocks[0].size() / secs / 1e9;
+}
+
+static double bench_decode(const ErasureCode &code, const vector<vector<string>> &fragments, vector<string> &blocks)
+{
+    blocks.resize(fragments.size());
+    auto start = high_resolution_clock::now();
+    for (size_t i = 0; i < fragments.size(); ++i)
+    {
+        vector<const string *> in;
+        for (int index = 0; index < code.fragments(); ++index)
+        {
+            in.push_back(index < code.parity() ? nullptr : &fragments[i][index]);
+        }
+        BlockCodec::Codec codec;
+        if (!code.decode(in, blocks[i], codec))
+        {
+            blocks[i].clear();
+        }
+    }
+    double secs = duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1e6;
+    return fragments.size() * blocks[0].size() / secs / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    initLogging();
+    auto log = logger();
+
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " [config_file] [total_mb] [rtt_ms ...]" << endl;
+        return EX_USAGE;
+    }
+
+    INIReader config(argv[1]);
+    if (config.ParseError() < 0)
+    {
+        cerr << "Error parsing config file " << argv[1] << endl;
+        return EX_CONFIG;
+    }
+
+    long blocksize = config.GetInteger("uploader", "blocksize", -1);
+    if (blocksize <= 0)
+    {
+        log->error("Invalid block size: {}", blocksize);
+        return EX_CONFIG;
+    }
+    int data = (int)config.GetInteger("uploader", "erasure_data", 2);
+    int parity = (int)config.GetInteger("uploader", "erasure_parity", 1);
+    if (data <= 0 || parity < 0 || data + parity > 255)
+    {
+        log->error("Invalid erasure code: {} data, {} parity fragments", data, parity);
+        return EX_CONFIG;
+    }
+    size_t total_mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+    size_t num_blocks = max((size_t)1, total_mb * 1000000 / blocksize);
+
+    mt19937_64 rng(42);
+    vector<string> blocks(num_blocks, string(blocksize, '\0'));
+    for (string &block : blocks)
+    {
+        for (char &c : block)
+        {
+            c = (char)rng();
+        }
+    }
+    log->info("Coding {} blocks of {} bytes into {} data and {} parity fragments", num_blocks, blocksize, data, parity);
+
+    double baseline = 0;
+    ErasureCode::Engine engines[] = {ErasureCode::SCALAR, ErasureCode::SSSE3, ErasureCode::AVX2};
+    for (ErasureCode::Engine engine : engines)
+    {
+        if (!ErasureCode::supported(engine))
+        {
+            log->info("{}: not supported by this CPU", ErasureCode::name(engine));
+            continue;
+        }
+
+        ErasureCode code(data, parity, engine);
+        vector<vector<string>> fragments;
+        vector<string> rebuilt;
+        bench_encode(code, blocks, fragments);
+        bench_decode(code, fragments, rebuilt);
+        double encode_gbs = bench_encode(code, blocks, fragments);
+        double decode_gbs = bench_decode(code, fragments, rebuilt);
+        if (rebuilt != blocks)
+        {
+            log->error("{}: rebuilt blocks differ from the originals", ErasureCode::name(engine));
+            return 1;
+        }
+        if (engine == ErasureCode::SCALAR)
+        {
+            baseline = encode_gbs;
+        }
+        log->info("{}: encode {:.2f} GB/s ({:.1f}x scalar), rebuild without {} fragments {:.2f} GB/s",
+                  ErasureCode::name(engine), encode_gbs, encode_gbs / baseline, parity, decode_gbs);
+    }
+
+    // every fragment carries a header and the last data slice is padded
+    size_t slice = (blocksize + data - 1) / data;
+    double overhead = (double)(data + parity) * (ErasureCode::HEADER_SIZE + slice) / blocksize;
+    log->info("tworandom: 2.00x the block uploaded and stored, 1 server may be lost");
+    log->info("erasure: {:.2f}x the block uploaded and stored, {} servers may be lost", overhead, parity);
+
+    vector<double> rtts;
+    for (int i = 3; i < argc; ++i)
+    {
+        rtts.push_back(strtod(argv[i], NULL));
+    }
+    int num_servers = (int)rtts.size();
+    if (num_servers == 0)
+    {
+        return 0;
+    }
+    if (num_servers < max(2, data + parity))
+    {
+        log->error("Need the RTTs of at least {} servers", max(2, data + parity));
+        return EX_USAGE;
+    }
+
+    // tworandom: any two different servers, equally likely
+    double replicated = 0;
+    for (int a = 0; a < num_servers; ++a)
+    {
+        for (int b = a + 1; b < num_servers; ++b)
+        {
+            replicated += min(rtts[a], rtts[b]);
+        }
+    }
+    replicated /= num_servers * (num_servers - 1) / 2;
+
+    // erasure: fragments on data + parity servers in a row from any server
+    double erasure = 0;
+    for (int first = 0; first < num_servers; ++first)
+    {
+        vector<double> fragment_rtts;
+        for (int index = 0; index < data + parity; ++index)
+        {
+            fragment_rtts.push_back(rtts[(first + index) % num_servers]);
+        }
+        nth_element(fragment_rtts.begin(), fragment_rtts.begin() + data - 1, fragment_rtts.end());
+        erasure += fragment_rtts[data - 1];
+    }
+    erasure /= num_servers;
+
+    log->info("First reply for a small block: tworandom {:.1f} ms, erasure {:.1f} ms", replicated, erasure);
+    return 0;
+}
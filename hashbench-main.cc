@@ -0,0 +1,133 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <string>
+#include <vector>
+#include <sysexits.h>
+#include <stdlib.h>
+
+#include "inih/INIReader.h"
+
+#include "logger.hpp"
+#include "BlockHasher.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+/**
+ * Micro-benchmark for the uploader's block hashing.
+ *
+ * Hashes total_mb of random blocks of the configured [uploader] blocksize
+ * with every hash engine this CPU supports, once on a single thread and
+ * once on hash_threads threads (default: one per core), and reports GB/s.
+ * The scalar engine is picosha2, which is what the uploader used before.
+ * Every engine's hashes are checked against picosha2's.
+ */
+
+static double bench(BlockHasher::Engine engine, const vector<string> &blocks, size_t threads, vector<BlockHash> &hashes)
+{
+    BlockHasher hasher(engine);
+    hashes.assign(blocks.size(), BlockHash());
+
+    auto start = high_resolution_clock::now();
+    vector<thread> workers;
+    for (size_t w = 0; w < threads; ++w)
+    {
+        // each thread hashes every threads-th run of lanes() blocks
+        workers.push_back(thread([&, w]() {
+            size_t lanes = hasher.lanes();
+            for (size_t first = w * lanes; first < blocks.size(); first += threads * lanes)
+            {
+                vector<const string *> in;
+                vector<BlockHash *> out;
+                for (size_t i = first; i < min(first + lanes, blocks.size()); ++i)
+                {
+                    in.push_back(&blocks[i]);
+                    out.push_back(&hashes[i]);
+                }
+                hasher.hash_many(in, out);
+            }
+        }));
+    }
+    for (thread &t : workers)
+    {
+        t.join();
+    }
+    double secs = duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1e6;
+
+    return blocks.size() * blocks[0].size() / secs / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    initLogging();
+    auto log = logger();
+
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " [config_file] [total_mb]" << endl;
+        return EX_USAGE;
+    }
+
+    INIReader config(argv[1]);
+    if (config.ParseError() < 0)
+    {
+        cerr << "Error parsing config file " << argv[1] << endl;
+        return EX_CONFIG;
+    }
+
+    long blocksize = config.GetInteger("uploader", "blocksize", -1);
+    if (blocksize <= 0)
+    {
+        log->error("Invalid block size: {}", blocksize);
+        return EX_CONFIG;
+    }
+    size_t threads = (size_t)config.GetInteger("uploader", "hash_threads", max(1u, thread::hardware_concurrency()));
+    size_t total_mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+    size_t num_blocks = max((size_t)1, total_mb * 1000000 / blocksize);
+
+    mt19937_64 rng(42);
+    vector<string> blocks(num_blocks, string(blocksize, '\0'));
+    for (string &block : blocks)
+    {
+        for (char &c : block)
+        {
+            c = (char)rng();
+        }
+    }
+    log->info("Hashing {} blocks of {} bytes", num_blocks, blocksize);
+
+    vector<BlockHash> reference;
+    double baseline = bench(BlockHasher::SCALAR, blocks, 1, reference);
+
+    BlockHasher::Engine engines[] = {BlockHasher::SCALAR, BlockHasher::AVX2, BlockHasher::SHANI};
+    for (BlockHasher::Engine engine : engines)
+    {
+        if (!BlockHasher::supported(engine))
+        {
+            log->info("{}: not supported by this CPU", BlockHasher::name(engine));
+            continue;
+        }
+
+        vector<size_t> thread_counts(1, 1);
+        if (threads > 1)
+        {
+            thread_counts.push_back(threads);
+        }
+        for (size_t t : thread_counts)
+        {
+            vector<BlockHash> hashes;
+            double gbs = bench(engine, blocks, t, hashes);
+            if (hashes != reference)
+            {
+                log->error("{}: hashes differ from picosha2's", BlockHasher::name(engine));
+                return 1;
+            }
+            log->info("{} on {} threads: {:.2f} GB/s, {:.1f}x picosha2", BlockHasher::name(engine), t, gbs, gbs / baseline);
+        }
+    }
+
+    return 0;
+}